@@ -0,0 +1,122 @@
+#include "aot.h"
+#include "codegen.h"
+#include "error.h"
+#include "kcomp_config.h"
+#include "options.h"
+#include "time_report.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetOptions.h"
+
+bool AOTCompiler::compile(const symbol_vector_t & entry_points)
+{
+  TimeReport::beginItem("program");
+  Codegen::optimizeWholeProgram(*Codegen::the_module);
+  Codegen::the_module = Codegen::optimizeModule(std::move(Codegen::the_module),
+						Codegen::getTargetMachine());
+  llvm::Module & module = *Codegen::the_module;
+  // after the interprocedural passes, which would internalize main
+  addMain(module, entry_points);
+
+  if (!Options::emit_exe)
+  {
+    return emitObject(module, Options::output_file);
+  }
+  std::string object = Options::output_file + ".o";
+  bool ok = emitObject(module, object) && link(object, Options::output_file);
+  llvm::sys::fs::remove(object);
+  return ok;
+}
+
+void AOTCompiler::addMain(llvm::Module & module,
+			  const symbol_vector_t & entry_points)
+{
+  auto & context = module.getContext();
+  llvm::Type * double_ty = llvm::Type::getDoubleTy(context);
+  llvm::Type * int_ty = llvm::Type::getInt32Ty(context);
+
+  llvm::Constant * print_result = module.getOrInsertFunction(
+    "kcomp_print_result", llvm::Type::getVoidTy(context), double_ty);
+  llvm::Function * main_fn = llvm::Function::Create(
+    llvm::FunctionType::get(int_ty, false),
+    llvm::Function::ExternalLinkage, "main", &module);
+
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", main_fn));
+  for (symbol_t name : entry_points)
+  {
+    llvm::Value * result = 
+      builder.CreateCall(module.getFunction(Symbols::name(name)));
+    builder.CreateCall(print_result, result);
+  }
+  builder.CreateRet(llvm::ConstantInt::get(int_ty, 0));
+  llvm::verifyFunction(*main_fn);
+}
+
+bool AOTCompiler::emitObject(llvm::Module & module, const std::string & path)
+{
+  std::string triple = llvm::sys::getDefaultTargetTriple();
+  std::string error;
+  const llvm::Target * target = llvm::TargetRegistry::lookupTarget(triple, 
+								    error);
+  if (!target)
+  {
+    Error::log(error);
+    return false;
+  }
+
+  // position independent, so that the object links into PIE executables
+  llvm::TargetOptions options;
+  std::unique_ptr<llvm::TargetMachine> tm(target->createTargetMachine(
+    triple, llvm::sys::getHostCPUName(), "", options, llvm::Reloc::PIC_));
+  Codegen::configureBackend(*tm);
+  module.setTargetTriple(triple);
+  module.setDataLayout(tm->createDataLayout());
+
+  std::error_code ec;
+  llvm::raw_fd_ostream out(path, ec, llvm::sys::fs::F_None);
+  if (ec)
+  {
+    Error::log("Could not open " + path + ": " + ec.message());
+    return false;
+  }
+
+  llvm::legacy::PassManager pm;
+  if (tm->addPassesToEmitFile(pm, out, nullptr, 
+			      llvm::TargetMachine::CGFT_ObjectFile))
+  {
+    Error::log("The target cannot emit object files");
+    return false;
+  }
+  {
+    TimeReport::Timer timer(phase_backend);
+    pm.run(module);
+  }
+  out.flush();
+  return true;
+}
+
+bool AOTCompiler::link(const std::string & object, const std::string & exe)
+{
+  auto linker = llvm::sys::findProgramByName(kcomp_LINKER);
+  if (!linker)
+  {
+    Error::log(std::string("Linker not found: ") + kcomp_LINKER);
+    return false;
+  }
+  llvm::StringRef args[] = {
+    *linker, object, kcomp_RUNTIME_LIB, "-lm", "-o", exe
+  };
+  std::string error;
+  TimeReport::Timer timer(phase_link);
+  if (llvm::sys::ExecuteAndWait(*linker, args, llvm::None, {}, 0, 0, &error))
+  {
+    Error::log("Linking " + exe + " failed" + 
+	       (error.empty() ? "" : ": " + error));
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,27 @@
+#ifndef _AOT_H_
+#define _AOT_H_
+
+#include <string>
+
+#include "k_llvm.h"
+#include "symbol.h"
+
+// Ahead-of-time compilation of a whole program (see Parser::parseProgram)
+// to an object file, and optionally to an executable linked with the
+// runtime of externs.cpp whose main() runs the top-level expressions.
+class AOTCompiler {
+ public:
+  // optimize the program in Codegen::the_module and write the output file
+  // selected on the command line, returns false on error
+  static bool compile(const symbol_vector_t & entry_points);
+
+ private:
+  // define main() calling the entry points in order and printing their
+  // results like the JIT does
+  static void addMain(llvm::Module & module,
+		      const symbol_vector_t & entry_points);
+  static bool emitObject(llvm::Module & module, const std::string & path);
+  static bool link(const std::string & object, const std::string & exe);
+};
+
+#endif
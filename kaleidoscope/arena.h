@@ -0,0 +1,81 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/Allocator.h"
+
+// Bump-pointer arena for the expression nodes of one top-level item. Nodes
+// are never freed one by one: the whole tree goes away with reset(), which
+// keeps the first slab around so steady state parsing does not call malloc.
+// Only trivially destructible types may be placed in the arena.
+class ASTArena {
+ private:
+  llvm::BumpPtrAllocator allocator;
+
+  // statistics, accumulated over the lifetime of the arena
+  size_t num_nodes = 0;
+  size_t num_slabs = 0;     // slabs malloc'ed so far
+  size_t kept_slabs = 0;    // slabs that survived the last reset
+  size_t max_bytes = 0;     // peak size of a single tree
+
+ public:
+  template <typename T, typename... Args>
+  T * make(Args &&... args)
+  {
+    static_assert(std::is_trivially_destructible<T>::value,
+		  "arena nodes are released without running destructors");
+    ++num_nodes;
+    return new (allocator.Allocate<T>()) T(std::forward<Args>(args)...);
+  }
+
+  // copy a list (e.g. call arguments) into the arena
+  template <typename T>
+  llvm::MutableArrayRef<T> copy(llvm::ArrayRef<T> list)
+  {
+    static_assert(std::is_trivially_destructible<T>::value,
+		  "arena nodes are released without running destructors");
+    T * copy = allocator.Allocate<T>(list.size());
+    std::uninitialized_copy(list.begin(), list.end(), copy);
+    return llvm::MutableArrayRef<T>(copy, list.size());
+  }
+
+  // release every node allocated since the last reset
+  void reset()
+  {
+    num_slabs += allocator.GetNumSlabs() - kept_slabs;
+    kept_slabs = allocator.GetNumSlabs() ? 1 : 0;
+    if (allocator.getBytesAllocated() > max_bytes)
+    {
+      max_bytes = allocator.getBytesAllocated();
+    }
+    allocator.Reset();
+  }
+
+  // take over the nodes allocated in other since its last reset, so that a
+  // tree outlives the reset of the arena it was parsed into
+  void adopt(ASTArena & other)
+  {
+    other.num_slabs += other.allocator.GetNumSlabs() - other.kept_slabs;
+    other.kept_slabs = 0;
+    if (other.allocator.getBytesAllocated() > other.max_bytes)
+    {
+      other.max_bytes = other.allocator.getBytesAllocated();
+    }
+    allocator = std::move(other.allocator);
+  }
+
+  size_t getNumNodes() const { return num_nodes; }
+  size_t getNumSlabs() const 
+  { 
+    return num_slabs + allocator.GetNumSlabs() - kept_slabs; 
+  }
+  size_t getMaxBytes() const { return max_bytes; }
+};
+
+#endif
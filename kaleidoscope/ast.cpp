@@ -1,9 +1,17 @@
 #include "ast.h"
 #include "codegen.h"
 #include "error.h"
+#include "kcomp.h"
+#include "options.h"
+#include "profile.h"
+#include "time_report.h"
 
 llvm::Value * NumberExprAST::codegen()
 {
+  if (type == type_int)
+  {
+    return llvm::ConstantInt::get(Codegen::llvmType(type), int64_t(val));
+  }
   return llvm::ConstantFP::get(Codegen::the_context, llvm::APFloat(val));
 }
 
@@ -14,9 +22,8 @@ llvm::Value * IfExprAST::codegen()
   {
     return nullptr;
   }
-  // Convert condition to a bool by comarison non-equal to 0.0 
-  condv = Codegen::builder.CreateFCmpONE(condv, 
-    llvm::ConstantFP::get(Codegen::the_context, llvm::APFloat(0.0)), "ifcond");
+  // Convert condition to a bool by comarison non-equal to 0
+  condv = Codegen::createCondition(condv, Cond->getType(), "ifcond");
 
   llvm::Function * the_function = Codegen::builder.GetInsertBlock()->getParent();
   // create blocks for the then and the else cases. Insert the 'then' block at
@@ -37,6 +44,7 @@ llvm::Value * IfExprAST::codegen()
   {
     return nullptr;
   }
+  then_v = Codegen::convert(then_v, Then->getType(), type);
   Codegen::builder.CreateBr(merge_bb);
   // codegen of 'then' can change the current block, update elseBB for the phi
   then_bb = Codegen::builder.GetInsertBlock();
@@ -49,6 +57,7 @@ llvm::Value * IfExprAST::codegen()
   {
     return nullptr;
   }
+  else_v = Codegen::convert(else_v, Else->getType(), type);
   Codegen::builder.CreateBr(merge_bb);
   // codegen of else can change the current block, update elsebb for the phi
   else_bb = Codegen::builder.GetInsertBlock();
@@ -57,8 +66,7 @@ llvm::Value * IfExprAST::codegen()
   the_function->getBasicBlockList().push_back(merge_bb);
   Codegen::builder.SetInsertPoint(merge_bb);
   llvm::PHINode * pn = 
-    Codegen::builder.CreatePHI(llvm::Type::getDoubleTy(Codegen::the_context), 
-			       2, "iftmp");
+    Codegen::builder.CreatePHI(Codegen::llvmType(type), 2, "iftmp");
   pn->addIncoming(then_v, then_bb);
   pn->addIncoming(else_v, else_bb);
   return pn;
@@ -72,6 +80,7 @@ llvm::Value * ForExprAST::codegen()
   {
     return nullptr;
   }
+  start_val = Codegen::convert(start_val, start->getType(), var_type);
   llvm::Function * the_function = 
     Codegen::builder.GetInsertBlock()->getParent();
   llvm::BasicBlock * pre_header_bb = Codegen::builder.GetInsertBlock();
@@ -84,16 +93,17 @@ llvm::Value * ForExprAST::codegen()
   // start insertion in loop_bb
   Codegen::builder.SetInsertPoint(loop_bb);
   
-  // start the PHI node with an entry for start
+  // start the PHI node with an entry for start; an integer variable is an
+  // i64 induction variable that scalar evolution can analyze
   llvm::PHINode * variable = 
-    Codegen::builder.CreatePHI(llvm::Type::getDoubleTy(Codegen::the_context),
-			       2, var_name.c_str());
+    Codegen::builder.CreatePHI(Codegen::llvmType(var_type), 2,
+			       Symbols::name(var_name));
   variable->addIncoming(start_val, pre_header_bb);
 
-  // Within the loop, the variable is defined equal to the PHI node.  If it
-  // shadows an existing variable, we have to restore it, so save it now.
-  llvm::Value * oldval = Codegen::named_values[var_name];
-  Codegen::named_values[var_name] = variable;
+  // Within the loop, the variable is defined equal to the PHI node. It
+  // shadows any existing variable of the same name until the scope ends.
+  Codegen::Scope scope(Codegen::named_values);
+  Codegen::named_values.insert(var_name, variable);
 
   // Emit the body of the loop.  This, like any other expr, can change the
   // current BB.  Note that we ignore the value computed by the body, but don't
@@ -112,14 +122,22 @@ llvm::Value * ForExprAST::codegen()
     {
       return nullptr;
     }
-    else
-    {
-      // if not specified, use 1.0 as the step
-      step_val = llvm::ConstantFP::get(Codegen::the_context, 
-				       llvm::APFloat(1.0));
-    }
+    step_val = Codegen::convert(step_val, step->getType(), var_type);
+  }
+  else if (var_type == type_int)
+  {
+    step_val = llvm::ConstantInt::get(Codegen::llvmType(var_type), 1);
   }
-  llvm::Value *next_var = 
+  else
+  {
+    // if not specified, use 1.0 as the step
+    step_val = llvm::ConstantFP::get(Codegen::the_context, 
+				     llvm::APFloat(1.0));
+  }
+  // an integer variable stays within max(|start|, |C|) + 2 * step < 2^53
+  // (see ForExprAST::inferType), the addition cannot overflow
+  llvm::Value * next_var = var_type == type_int ?
+    Codegen::builder.CreateNSWAdd(variable, step_val, "nextvar") :
     Codegen::builder.CreateFAdd(variable, step_val, "nextvar");
 
   // compute the end condition
@@ -129,12 +147,8 @@ llvm::Value * ForExprAST::codegen()
     return nullptr;
   }
   
-  // convert condition to a bool by comparing non-equal to 0.0
-  end_cond = 
-    Codegen::builder.CreateFCmpONE(end_cond,
-				   llvm::ConstantFP::get(Codegen::the_context,
-							 llvm::APFloat(0.0)), 
-				   "loopcond");
+  // convert condition to a bool by comparing non-equal to 0
+  end_cond = Codegen::createCondition(end_cond, end->getType(), "loopcond");
   // create the "after loop" block and insert it
   llvm::BasicBlock * loop_end_bb = Codegen::builder.GetInsertBlock();
   llvm::BasicBlock * after_bb = 
@@ -150,24 +164,14 @@ llvm::Value * ForExprAST::codegen()
   // add a new entry to the PHI node for the backedge
   variable->addIncoming(next_var, loop_end_bb);
 
-  // restore the unshadowed variable
-  if (oldval)
-  {
-    Codegen::named_values[var_name] = oldval;
-  }
-  else
-  {
-    Codegen::named_values.erase(var_name);
-  }
-
-  // for expr always returns 0.0
-  return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(Codegen::the_context));
+  // for expr always returns 0
+  return llvm::Constant::getNullValue(Codegen::llvmType(type));
 }
 
 llvm::Value * VariableExprAST::codegen()
 {
   // look this variable up in the function
-  llvm::Value * v = Codegen::named_values[name];
+  llvm::Value * v = Codegen::named_values.lookup(name);
   if (!v)
   {
     Error::logV("Unknown variable name");
@@ -183,29 +187,41 @@ llvm::Value * BinaryExprAST::codegen()
   {
     return nullptr;	
   }
+  // compare integers if both operands are, on doubles otherwise; the
+  // arithmetic is done in the type of the result, a double when integers
+  // could reach 2^53, and then cannot overflow (see types.h)
+  ValueType operands = op == '<' ?
+    joinTypes(promoteType(lhs->getType()), promoteType(rhs->getType())) :
+    promoteType(type);
+  l = Codegen::convert(l, lhs->getType(), operands);
+  r = Codegen::convert(r, rhs->getType(), operands);
+  bool ints = operands == type_int;
   
   switch(op)
   {
   case '+':
   {
-    return Codegen::builder.CreateFAdd(l, r, "addtmp");
+    return Codegen::convert(
+      ints ? Codegen::builder.CreateNSWAdd(l, r, "addtmp") :
+      Codegen::builder.CreateFAdd(l, r, "addtmp"), operands, type);
   }
   case '-':
   {
-    return Codegen::builder.CreateFSub(l, r, "subtmp");
+    return Codegen::convert(
+      ints ? Codegen::builder.CreateNSWSub(l, r, "subtmp") :
+      Codegen::builder.CreateFSub(l, r, "subtmp"), operands, type);
   }
   case '*':
   {
-    return Codegen::builder.CreateFMul(l, r, "multmp");
+    return Codegen::convert(
+      ints ? Codegen::builder.CreateNSWMul(l, r, "multmp") :
+      Codegen::builder.CreateFMul(l, r, "multmp"), operands, type);
   }
   case '<':
   {
-    l = Codegen::builder.CreateFCmpULT(l, r, "cmptmp");
-    // convert bool 0/1 to double 0.0 or 1.0
-    return Codegen::
-      builder.CreateUIToFP(l, 
-			   llvm::Type::getDoubleTy(Codegen::the_context), 
-			   "booltmp");
+    return Codegen::convert(
+      ints ? Codegen::builder.CreateICmpSLT(l, r, "cmptmp") :
+      Codegen::builder.CreateFCmpULT(l, r, "cmptmp"), type_bool, type);
   }
   default: 
   {
@@ -217,7 +233,7 @@ llvm::Value * BinaryExprAST::codegen()
 llvm::Value * CallExprAST::codegen()
 {
   // look up the name in the global module table
-  llvm::Function * caleef = PrototypeAST::getFunction(callee);
+  llvm::Function * caleef = PrototypeAST::getFunction(callee, entry, type);
   if (!caleef)
   {
     return Error::logV("Unknown function referenced");
@@ -230,89 +246,246 @@ llvm::Value * CallExprAST::codegen()
   std::vector<llvm::Value *> args_v;
   for (unsigned i = 0, e = args.size(); i!= e; ++i)
   {
-    args_v.push_back(args[i]->codegen());
-    if (!args_v.back())
+    llvm::Value * arg = args[i]->codegen();
+    if (!arg)
     {
       return nullptr;
     }
+    args_v.push_back(Codegen::convert(arg, args[i]->getType(), type_double));
   }
   return Codegen::builder.CreateCall(caleef, args_v, "calltmp");
 }
 
-std::map<std::string, std::unique_ptr<PrototypeAST>> PrototypeAST::function_protos;
+void PrototypeAST::setReturnType(ValueType type)
+{
+  ret_type = type;
+  entry = entryName(name, type);
+}
+
+symbol_t PrototypeAST::entryName(symbol_t name, ValueType type)
+{
+  if (type != type_bool && type != type_int)
+  {
+    return name;
+  }
+  return Symbols::intern(Symbols::name(name).str() + "." + typeName(type));
+}
 
-llvm::Function * PrototypeAST::codegen()
+llvm::Function * PrototypeAST::codegen(symbol_t entry, ValueType type)
 {
   // make the function type: double(double,double) etc...
   std::vector<llvm::Type *> doubles(args.size(),
       llvm::Type::getDoubleTy(Codegen::the_context));
   llvm::FunctionType * ft = llvm::FunctionType::get(
-      llvm::Type::getDoubleTy(Codegen::the_context),
-	  doubles, false);
+      Codegen::llvmType(type), doubles, false);
+  // already in the module, e.g. an extern after the definition in the
+  // single module of --batch and -c: a second declaration would be renamed
+  // and the calls bound to it left undefined
+  if (auto * f = Codegen::the_module->getFunction(Symbols::name(entry)))
+  {
+    if (f->getFunctionType() != ft)
+    {
+      Error::log("Conflicting declaration of '" + Symbols::name(name).str() +
+		 "'");
+      return nullptr;
+    }
+    Codegen::functions[entry] = f;
+    return f;
+  }
   llvm::Function * f = llvm::Function::Create(ft, 
       llvm::Function::ExternalLinkage, 
-      name, Codegen::the_module.get());
+      Symbols::name(entry), Codegen::the_module.get());
+  Codegen::functions[entry] = f;
 
   // set names for all arguments
   unsigned idx = 0;
   for (auto &arg : f->args())
   {
-    arg.setName(args[idx++]);
+    arg.setName(Symbols::name(args[idx++]));
   }
   return f;
 }
 
-llvm::Function * PrototypeAST::getFunction(std::string name)
+llvm::Function * PrototypeAST::getFunction(symbol_t name, symbol_t entry,
+					   ValueType type)
 {
   // try to find an existing function with this name in the current module
-  if (auto * f = Codegen::the_module->getFunction(name))
+  if (auto * f = Codegen::functions.lookup(entry))
   {
     return f;
   }
   // if not check whether we can codegen the declaraction from the existing prototypes
-  auto fi = function_protos.find(name);
-  if (fi != function_protos.end())
+  if (auto proto = find(name))
   {
-    return fi->second->codegen();
+    return proto->codegen(entry, type);
   }
   // if no prototype exists, then there is no function defined, return null
   return nullptr;
 }
 
-llvm::Function * FunctionAST::codegen()
+thread_local unsigned PrototypeAST::visible_stamp = ~0u;
+
+void PrototypeAST::addPrototype(std::shared_ptr<PrototypeAST> proto)
+{
+  auto & compiler = KCompiler::current();
+  std::lock_guard<std::mutex> lock(compiler.prototypes_mutex);
+  auto & slot = compiler.prototypes[proto->getname()];
+  if (slot == proto)
+  {
+    return;
+  }
+  proto->stamp = ++compiler.prototype_stamp;
+  if (Options::jobs > 1)
+  {
+    // definitions submitted before this one may still be compiling
+    proto->previous = std::move(slot);
+  }
+  slot = std::move(proto);
+}
+
+std::shared_ptr<PrototypeAST> PrototypeAST::find(symbol_t name)
+{
+  auto & compiler = KCompiler::current();
+  std::lock_guard<std::mutex> lock(compiler.prototypes_mutex);
+  auto fi = compiler.prototypes.find(name);
+  if (fi == compiler.prototypes.end())
+  {
+    return nullptr;
+  }
+  std::shared_ptr<PrototypeAST> proto = fi->second;
+  while (proto && proto->stamp > visible_stamp)
+  {
+    proto = proto->previous;
+  }
+  return proto;
+}
+
+unsigned PrototypeAST::currentStamp()
+{
+  auto & compiler = KCompiler::current();
+  std::lock_guard<std::mutex> lock(compiler.prototypes_mutex);
+  return compiler.prototype_stamp;
+}
+
+void PrototypeAST::dropReplaced()
+{
+  auto & compiler = KCompiler::current();
+  std::lock_guard<std::mutex> lock(compiler.prototypes_mutex);
+  for (auto & proto : compiler.prototypes)
+  {
+    proto.second->previous.reset();
+  }
+}
+
+void FunctionAST::registerPrototype()
+{
+  if (!proto_registered)
+  {
+    PrototypeAST::addPrototype(proto);
+    proto_registered = true;
+  }
+}
+
+llvm::Function * FunctionAST::startFunction()
 {
   auto &p = *proto;
-  PrototypeAST::function_protos[proto->getname()] = std::move(proto);
-  llvm::Function * the_function = PrototypeAST::getFunction(p.getname());
+  registerPrototype();
+  llvm::Function * the_function = 
+    PrototypeAST::getFunction(name, p.getEntry(), p.getReturnType());
   if (!the_function)
   {
     return nullptr;
   }
+  if (p.getEntry() != name)
+  {
+    // only called from its module (see KCompiler::whole_program), the
+    // double entry point is what the JIT puts behind a stub
+    the_function->setLinkage(llvm::Function::InternalLinkage);
+  }
+  Codegen::setFunctionAttributes(*the_function);
   // create a new basic block to start insertion into 
   llvm::BasicBlock * bb = 
 	llvm::BasicBlock::Create(Codegen::the_context,
 		                 "entry",
 			         the_function);
   Codegen::builder.SetInsertPoint(bb);
+  profile_start = nullptr;
+  if (Profiler::enabled() && !isTopLevelExpr())
+  {
+    profile_start = Profiler::emitEnter(name);
+  }
   
-  // record the function arguments in the named values map
-  Codegen::named_values.clear();
+  // record the function arguments in the scope opened by the caller
+  unsigned idx = 0;
   for (auto &arg : the_function->args())
   {
-    Codegen::named_values[arg.getName()] = &arg;
+    Codegen::named_values.insert(p.getargs()[idx++], &arg);
   }
-  if (llvm::Value * ret_val = body->codegen())
+  return the_function;
+}
+
+llvm::Function * FunctionAST::finishFunction(llvm::Function * the_function,
+					     llvm::Value * ret_val,
+					     ValueType ret_type)
+{
+  if (ret_val)
   {
     // finish off the function
+    ret_val = Codegen::convert(ret_val, ret_type, proto->getReturnType());
+    Profiler::emitExit(name, profile_start);
     Codegen::builder.CreateRet(ret_val);
     //validate the generated code, checking for consistency
     llvm::verifyFunction(*the_function);
     // optimize the funciton
-    Codegen::fpm->run(*the_function);
+    if (Codegen::fpm)
+    {
+      TimeReport::Timer timer(phase_optimize);
+      Codegen::fpm->run(*the_function);
+    }
+    if (proto->getEntry() != name)
+    {
+      emitDoubleEntry(the_function);
+    }
     
     return the_function;
   }
+  Codegen::functions.erase(proto->getEntry());
   the_function->eraseFromParent();
   return nullptr;
 }
 
+void FunctionAST::emitDoubleEntry(llvm::Function * typed)
+{
+  llvm::Function * f = Codegen::functions.lookup(name);
+  if (!f)
+  {
+    f = proto->codegen();
+  }
+  else if (!f->empty())
+  {
+    return;
+  }
+  Codegen::builder.SetInsertPoint(
+    llvm::BasicBlock::Create(Codegen::the_context, "entry", f));
+  std::vector<llvm::Value *> args;
+  for (auto & arg : f->args())
+  {
+    args.push_back(&arg);
+  }
+  llvm::Value * ret_val = Codegen::builder.CreateCall(typed, args, "calltmp");
+  Codegen::builder.CreateRet(
+    Codegen::convert(ret_val, proto->getReturnType(), type_double));
+  llvm::verifyFunction(*f);
+}
+
+llvm::Function * FunctionAST::codegen()
+{
+  TimeReport::Timer timer(phase_codegen);
+  Codegen::Scope scope(Codegen::named_values);
+  llvm::Function * the_function = startFunction();
+  if (!the_function)
+  {
+    return nullptr;
+  }
+  return finishFunction(the_function, body->codegen(), body->getType());
+}
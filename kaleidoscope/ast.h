@@ -2,16 +2,59 @@
 #define _AST_H_
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "k_llvm.h"
+#include "symbol.h"
+#include "flat_ast.h"
+#include "types.h"
 
-// ExprAST Base class for all expression nodes of the tree
+class ASTArena;
+class Simplifier;
+class NumberExprAST;
+
+// ExprAST Base class for all expression nodes of the tree. Nodes live in
+// an ASTArena and are released together with it, so children are plain
+// pointers and nodes must stay trivially destructible.
 class ExprAST {
+ protected:
+  ~ExprAST() = default;
+
+  // set by inferType(), every value is a double until it ran; codegen()
+  // returns a value of this type
+  ValueType type = type_double;
+  // with the type, the magnitude of an integer or bool is below 2^bits
+  // (see types.h)
+  unsigned char bits = 0;
+
  public:
-  virtual ~ExprAST() {}
   virtual llvm::Value * codegen() = 0;
+  // append the subtree to a flat encoding, returns the index of its root
+  virtual flat_index_t flatten(FlatAST & flat) = 0;
+
+  // fold constants and simplify the subtree before IR is built (see
+  // simplify.h); returns the node to use in place of this one
+  virtual ExprAST * simplify(Simplifier & s) = 0;
+  // false if evaluating the node can neither call out nor fail to terminate
+  virtual bool hasSideEffects() const = 0;
+  // true if codegen of the subtree would not report an error, subtrees are
+  // only dropped by simplify() when they are valid
+  virtual bool isValid(Simplifier & s) const = 0;
+  virtual const NumberExprAST * asNumber() const { return nullptr; }
+  // true if the node is the variable name
+  virtual bool isVariable(symbol_t name) const { return false; }
+  // true if the node is the comparison var < limit with a constant limit
+  virtual bool isUpperBound(symbol_t var, double & limit) const
+  {
+    return false;
+  }
+
+  // type the subtree (see types.h), returns the type of the node
+  virtual ValueType inferType(TypeInference & t) = 0;
+  ValueType getType() const { return type; }
+  unsigned getBits() const { return bits; }
 };
 
 // Number ExprAST - Expression class for numeric literals
@@ -23,119 +66,227 @@ class NumberExprAST : public ExprAST {
   NumberExprAST(double val) : val(val) {}
   double getVal() const { return val; }
   llvm::Value * codegen() override;
+  flat_index_t flatten(FlatAST & flat) override;
+  ExprAST * simplify(Simplifier & s) override { return this; }
+  bool hasSideEffects() const override { return false; }
+  bool isValid(Simplifier & s) const override { return true; }
+  const NumberExprAST * asNumber() const override { return this; }
+  ValueType inferType(TypeInference & t) override;
 };
 
 class IfExprAST : public ExprAST {
-  std::unique_ptr<ExprAST> Cond, Then, Else;
+  ExprAST * Cond, * Then, * Else;
 
   public:
-    IfExprAST(std::unique_ptr<ExprAST> Cond, 
-              std::unique_ptr<ExprAST> Then, 
-              std::unique_ptr<ExprAST> Else)
+    IfExprAST(ExprAST * Cond, ExprAST * Then, ExprAST * Else)
       :
-      Cond(std::move(Cond)),
-      Then(std::move(Then)),
-      Else(std::move(Else))
+      Cond(Cond),
+      Then(Then),
+      Else(Else)
     {}
     llvm::Value *codegen() override;
+    flat_index_t flatten(FlatAST & flat) override;
+    ExprAST * simplify(Simplifier & s) override;
+    bool hasSideEffects() const override;
+    bool isValid(Simplifier & s) const override;
+    ValueType inferType(TypeInference & t) override;
 };
 
 class ForExprAST : public ExprAST {
-  std::string var_name;
-  std::unique_ptr<ExprAST> start, end, step, body;
+  symbol_t var_name;
+  ExprAST * start, * end, * step, * body;
+  // an integer loop variable is counted in an i64 induction variable
+  ValueType var_type = type_double;
 
  public:
-  ForExprAST(const std::string &var_name, std::unique_ptr<ExprAST> start,
-	     std::unique_ptr<ExprAST> end, std::unique_ptr<ExprAST> step,
-	     std::unique_ptr<ExprAST> body)
+  ForExprAST(symbol_t var_name, ExprAST * start, ExprAST * end, 
+	     ExprAST * step, ExprAST * body)
     :
-  var_name(var_name), start(std::move(start)), end(std::move(end)),
-    step(std::move(step)), body(std::move(body)) {}
+  var_name(var_name), start(start), end(end), step(step), body(body) {}
 
   llvm::Value * codegen() override;
+  flat_index_t flatten(FlatAST & flat) override;
+  ExprAST * simplify(Simplifier & s) override;
+  // a loop may not terminate, so it is never considered free of effects
+  bool hasSideEffects() const override { return true; }
+  bool isValid(Simplifier & s) const override;
+  ValueType inferType(TypeInference & t) override;
+
+ private:
+  // isValid() of a part of the loop with the loop variable in scope
+  bool isValidInLoop(Simplifier & s, const ExprAST * e) const;
 };
 
 // VariableExprAST - Expression class for variables 
 class VariableExprAST: public ExprAST {
 private:
-  std::string name;
+  symbol_t name;
 
 public:
-  VariableExprAST(const std::string &name) : name(name) {}
+  VariableExprAST(symbol_t name) : name(name) {}
   llvm::Value * codegen() override;
+  flat_index_t flatten(FlatAST & flat) override;
+  ExprAST * simplify(Simplifier & s) override { return this; }
+  bool hasSideEffects() const override { return false; }
+  bool isValid(Simplifier & s) const override;
+  bool isVariable(symbol_t var) const override { return var == name; }
+  ValueType inferType(TypeInference & t) override;
 };
 
 // BinaryExprAST - Expression class for a binary operator
 class BinaryExprAST : public ExprAST {
 private:
   char op;
-  std::unique_ptr<ExprAST> lhs, rhs;
+  ExprAST * lhs, * rhs;
 
 public:
-  BinaryExprAST(char op, 
-		std::unique_ptr<ExprAST> lhs,
-		std::unique_ptr<ExprAST> rhs) 
+  BinaryExprAST(char op, ExprAST * lhs, ExprAST * rhs) 
 	:
 	op(op),
-	lhs(std::move(lhs)), rhs(std::move(rhs)) {}
+	lhs(lhs), rhs(rhs) {}
 
 	llvm::Value * codegen() override;
+	flat_index_t flatten(FlatAST & flat) override;
+	ExprAST * simplify(Simplifier & s) override;
+	bool hasSideEffects() const override;
+	bool isValid(Simplifier & s) const override;
+	bool isUpperBound(symbol_t var, double & limit) const override;
+	ValueType inferType(TypeInference & t) override;
 };
 
-typedef std::vector<std::unique_ptr<ExprAST>> expr_ast_vector_t;
+// call arguments, copied into the arena of the node, which the simplifier
+// rewrites in place
+typedef llvm::MutableArrayRef<ExprAST *> expr_ast_list_t;
 
 // CallExprAST - This class represents a function call
 class CallExprAST : public ExprAST {
 private:
-  std::string callee;
-  expr_ast_vector_t args;
+  symbol_t callee;
+  symbol_t entry; // callee or its typed entry point, see PrototypeAST
+  expr_ast_list_t args;
 
 public:
-  CallExprAST(const std::string &callee,
-              expr_ast_vector_t args)
+  CallExprAST(symbol_t callee,
+              expr_ast_list_t args)
 	:
 	callee(callee),
-	args(std::move(args)) {}
+	entry(callee),
+	args(args) {}
 
 	llvm::Value * codegen() override;
+	flat_index_t flatten(FlatAST & flat) override;
+	ExprAST * simplify(Simplifier & s) override;
+	bool hasSideEffects() const override { return true; }
+	bool isValid(Simplifier & s) const override;
+	ValueType inferType(TypeInference & t) override;
 };
 
 
-typedef std::vector<std::string> string_vector_t;
-
 // PrototypeAST - This class represents the prototype of a function,
-// which captures its name, and its argument names
+// which captures its name, and its argument names. Arguments are doubles;
+// a definition returning a bool or an integer (see types.h) is emitted as
+// the entry point name.i1 or name.i64 of that type, plus the double entry
+// point name that converts the result, so that name keeps the signature
+// every caller outside the typed code expects.
 class PrototypeAST { 
 private:
-  std::string name;
-  string_vector_t args;
-
-public:
-  static std::map<std::string, std::unique_ptr<PrototypeAST>> function_protos;
+  symbol_t name;
+  symbol_vector_t args;
+  ValueType ret_type = type_double;
+  symbol_t entry;  // name of the entry point returning ret_type
+  // order of registration, and with -j the prototype of the same name this
+  // one replaced, for the definitions submitted before it (see find())
+  unsigned stamp = 0;
+  std::shared_ptr<PrototypeAST> previous;
+  // registrations a definition compiled on this thread may see
+  static thread_local unsigned visible_stamp;
 
 public:
-  PrototypeAST(const std::string &name, string_vector_t args)
+  PrototypeAST(symbol_t name, symbol_vector_t args)
 	:
-	name(name), args(std::move(args)) {}
+	name(name), args(std::move(args)), entry(name) {}
 
-	const std::string &getname() const { return name; }
-	llvm::Function * codegen();
+	symbol_t getname() const { return name; }
+	const symbol_vector_t &getargs() const { return args; }
+	ValueType getReturnType() const { return ret_type; }
+	symbol_t getEntry() const { return entry; }
+	// set before the prototype is published
+	void setReturnType(ValueType type);
+	// declare the entry point named entry returning type
+	llvm::Function * codegen(symbol_t entry, ValueType type);
+	llvm::Function * codegen() { return codegen(name, type_double); }
 
-  static llvm::Function * getFunction(std::string name);
+  // the entry point of name returning a type other than double
+  static symbol_t entryName(symbol_t name, ValueType type);
+  static llvm::Function * getFunction(symbol_t name) 
+  {
+    return getFunction(name, name, type_double); 
+  }
+  static llvm::Function * getFunction(symbol_t name, symbol_t entry, 
+				      ValueType type);
+  // the prototypes known to the compiler of the calling thread (see
+  // kcomp.h), shared with the definitions still being compiled on other
+  // threads (see compile_pool.h)
+  static void addPrototype(std::shared_ptr<PrototypeAST> proto);
+  // the prototype of name, null if there is none. On a compile thread it
+  // is the one registered when the definition was submitted, so the
+  // functions defined after it are unknown as they are when compiling in
+  // order
+  static std::shared_ptr<PrototypeAST> find(symbol_t name);
+  // the registrations so far, for see()
+  static unsigned currentStamp();
+  // restrict find() on the calling thread to the registrations up to
+  // stamp, ~0 for all
+  static void see(unsigned stamp) { visible_stamp = stamp; }
+  // the replaced prototypes are not needed once no definition is being
+  // compiled
+  static void dropReplaced();
 };
 
-// FunctionAST - This calss represents a function definition itself
+// FunctionAST - This calss represents a function definition itself. The
+// body lives in the arena of the top-level item being compiled.
 class FunctionAST {
-  std::unique_ptr<PrototypeAST> proto;
-  std::unique_ptr<ExprAST> body;
+  symbol_t name;
+  std::shared_ptr<PrototypeAST> proto;
+  bool proto_registered = false;
+  ExprAST * body;
+  llvm::Value * profile_start = nullptr; // cycle counter at the entry
+
+  // register the prototype and open the entry block with the arguments in
+  // the scope of Codegen::named_values the caller opened, shared by both
+  // codegen walkers
+  llvm::Function * startFunction();
+  // emit the return of ret_val of type ret_type, or drop the function if
+  // the body failed
+  llvm::Function * finishFunction(llvm::Function * the_function,
+				  llvm::Value * ret_val, ValueType ret_type);
+  // the double entry point calling a typed one
+  void emitDoubleEntry(llvm::Function * typed);
 
 public:
   FunctionAST(std::unique_ptr<PrototypeAST> proto,
-			  std::unique_ptr<ExprAST> body)
+			  ExprAST * body)
 	:
-	proto(std::move(proto)), body(std::move(body)) {}
+	name(proto->getname()), proto(std::move(proto)), body(body) {}
 
+	symbol_t getName() const { return name; }
+	const PrototypeAST & getProto() const { return *proto; }
+	// make the prototype visible to callers, done by codegen unless the
+	// parser already did it
+	void registerPrototype();
 	llvm::Function * codegen();
+	// codegen through the flat encoding of the body (see flat_ast.h),
+	// lowered from the tree first unless given
+	llvm::Function * codegenFlat();
+	llvm::Function * codegenFlat(const FlatAST & flat);
+	void flattenBody(FlatAST & flat) { body->flatten(flat); }
+	void simplifyBody(ASTArena & arena);
+	// type the body and set the return type of the prototype, top-level
+	// expressions always return a double
+	void inferTypes();
+	bool isTopLevelExpr() const;
+	// the body folded to a literal, nullptr otherwise
+	const NumberExprAST * getConstantBody() const { return body->asNumber(); }
 };
 
 #endif
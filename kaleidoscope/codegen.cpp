@@ -1,23 +1,315 @@
 #include "codegen.h"
+#include "kcomp.h"
+#include "time_report.h"
 
-llvm::LLVMContext Codegen::the_context;
-llvm::IRBuilder<> Codegen::builder(the_context);
-std::unique_ptr<llvm::Module> Codegen::the_module;
-std::map<std::string, llvm::Value *> Codegen::named_values;
-std::unique_ptr<llvm::legacy::FunctionPassManager> Codegen::fpm;
-std::unique_ptr<llvm::orc::KaleidoscopeJIT> Codegen::jit;
+#include "llvm/Transforms/IPO/AlwaysInliner.h"
+
+thread_local llvm::LLVMContext Codegen::the_context;
+thread_local llvm::IRBuilder<> Codegen::builder(the_context);
+thread_local std::unique_ptr<llvm::Module> Codegen::the_module;
+thread_local named_values_t Codegen::named_values;
+thread_local llvm::DenseMap<symbol_t, llvm::Function *> Codegen::functions;
+thread_local std::unique_ptr<llvm::legacy::FunctionPassManager> Codegen::fpm;
+thread_local llvm::TargetMachine * Codegen::target_machine = nullptr;
+
+static llvm::FastMathFlags fastMathFlags(FastMath mode)
+{
+  llvm::FastMathFlags flags;
+  if (mode == fm_fast)
+  {
+    flags.setFast();
+  }
+  else if (mode == fm_contract)
+  {
+    flags.setAllowContract(true);
+  }
+  return flags;
+}
+
+KJIT & Codegen::getJIT()
+{
+  return *KCompiler::current().jit;
+}
+
+llvm::TargetMachine & Codegen::getTargetMachine()
+{
+  return target_machine ? *target_machine : getJIT().getTargetMachine();
+}
+
+KObjectCache * Codegen::getObjectCache()
+{
+  return KCompiler::current().object_cache.get();
+}
+
+OptLevel Codegen::getOptLevel()
+{
+  return KCompiler::current().opt_level;
+}
+
+FastMath Codegen::getFastMath()
+{
+  return KCompiler::current().fast_math;
+}
 
 void Codegen::initializeModuleAndPassManager()
 {
   // open a new module
   the_module = llvm::make_unique<llvm::Module>("my cool jit", the_context);
-  the_module->setDataLayout(jit->getTargetMachine().createDataLayout());
+  the_module->setDataLayout(getJIT().getTargetMachine().createDataLayout());
+  functions.clear();
+  initializeFunctionPassManager();
+  // the builder is per thread, each one picks up the mode with a new module
+  builder.setFastMathFlags(fastMathFlags(getFastMath()));
+}
+
+void Codegen::initializeFunctionPassManager()
+{
+  if (getJIT().optimizesModules())
+  {
+    fpm.reset();
+    return;
+  }
   fpm = llvm::make_unique<llvm::legacy::FunctionPassManager>(the_module.get());
-  
-  fpm->add(llvm::createInstructionCombiningPass());
-  fpm->add(llvm::createReassociatePass());
-  fpm->add(llvm::createGVNPass());
-  fpm->add(llvm::createCFGSimplificationPass());
-  
+  addFunctionPasses(*fpm, getTargetMachine());
   fpm->doInitialization();
 }
+
+void Codegen::setOptLevel(OptLevel level)
+{
+  KCompiler::current().opt_level = level;
+  initializeFunctionPassManager();
+  if (getObjectCache())
+  {
+    getObjectCache()->setConfiguration(getConfigurationId());
+  }
+}
+
+void Codegen::setFastMath(FastMath mode)
+{
+  KCompiler::current().fast_math = mode;
+  builder.setFastMathFlags(fastMathFlags(getFastMath()));
+}
+
+void Codegen::setFunctionAttributes(llvm::Function & f)
+{
+  if (Options::perf || Options::gdb)
+  {
+    // frame pointer call chains for perf record -g and the debuggers
+    f.addFnAttr("no-frame-pointer-elim", "true");
+  }
+  if (getFastMath() == fm_fast)
+  {
+    // what clang sets for -ffast-math, lets the backend reassociate and
+    // fuse what the IR passes left
+    f.addFnAttr("unsafe-fp-math", "true");
+    f.addFnAttr("no-infs-fp-math", "true");
+    f.addFnAttr("no-nans-fp-math", "true");
+    f.addFnAttr("no-signed-zeros-fp-math", "true");
+  }
+}
+
+// the handful of cheap function passes of -Ofast-compile
+static void addFastCompilePasses(llvm::legacy::PassManagerBase & pm)
+{
+  pm.add(llvm::createInstructionCombiningPass());
+  pm.add(llvm::createReassociatePass());
+  pm.add(llvm::createGVNPass());
+  pm.add(llvm::createCFGSimplificationPass());
+}
+
+// -O1 to -O3, set up the way clang does for the host target
+static void configureBuilder(llvm::PassManagerBuilder & pmb, unsigned level,
+			     llvm::TargetMachine & tm)
+{
+  pmb.OptLevel = level;
+  pmb.SizeLevel = 0;
+  pmb.Inliner = llvm::createFunctionInliningPass(level, 0, false);
+  pmb.LoopVectorize = level > 1;
+  pmb.SLPVectorize = level > 1;
+  pmb.LibraryInfo = new llvm::TargetLibraryInfoImpl(tm.getTargetTriple());
+  tm.adjustPassManager(pmb);
+}
+
+void Codegen::addFunctionPasses(llvm::legacy::FunctionPassManager & fpm,
+				llvm::TargetMachine & tm)
+{
+  switch (getOptLevel())
+  {
+  case opt_none:
+    break;
+  case opt_fast_compile:
+    addFastCompilePasses(fpm);
+    break;
+  default:
+  {
+    llvm::PassManagerBuilder pmb;
+    configureBuilder(pmb, getOptLevel(), tm);
+    fpm.add(llvm::createTargetTransformInfoWrapperPass(tm.getTargetIRAnalysis()));
+    pmb.populateFunctionPassManager(fpm);
+    break;
+  }
+  }
+}
+
+void Codegen::addModulePasses(llvm::legacy::PassManagerBase & mpm,
+			      llvm::TargetMachine & tm)
+{
+  OptLevel level = getOptLevel();
+  if (level == opt_none || level == opt_fast_compile)
+  {
+    return;
+  }
+  llvm::PassManagerBuilder pmb;
+  configureBuilder(pmb, level, tm);
+  mpm.add(llvm::createTargetTransformInfoWrapperPass(tm.getTargetIRAnalysis()));
+  pmb.populateModulePassManager(mpm);
+}
+
+void Codegen::configureBackend(llvm::TargetMachine & tm)
+{
+  tm.setOptLevel(llvm::CodeGenOpt::Level(Options::backend_opt));
+  // without optimization the target picks FastISel unless told otherwise,
+  // which also selects the fast register allocator
+  tm.setO0WantsFastISel(Options::isel != isel_global);
+  tm.setFastISel(Options::isel == isel_fast);
+  tm.setGlobalISel(Options::isel == isel_global);
+}
+
+void Codegen::initializeBackendOptions()
+{
+  // with GlobalISel, silently fall back to SelectionDAG on functions it
+  // cannot handle yet instead of aborting; the option only affects
+  // GlobalISel
+  auto & options = llvm::cl::getRegisteredOptions();
+  auto abort = options.find("global-isel-abort");
+  if (abort != options.end())
+  {
+    abort->second->addOccurrence(0, "global-isel-abort", "0");
+  }
+}
+
+std::string Codegen::getConfigurationId()
+{
+  auto & tm = getJIT().getTargetMachine();
+  return tm.getTargetTriple().str() + "/" + tm.getTargetCPU().str() + "/" + 
+    tm.getTargetFeatureString().str() + "/" +
+    Options::optLevelName(getOptLevel()) +
+    "/" + std::to_string(Options::backend_opt) + "/" + 
+    std::to_string(Options::isel);
+}
+
+// bodies of other modules linked in by the inliner
+static bool hasImportedBodies(const llvm::Module & module)
+{
+  for (auto & f : module)
+  {
+    if (f.hasAvailableExternallyLinkage())
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::unique_ptr<llvm::Module>
+Codegen::optimizeModule(std::unique_ptr<llvm::Module> module,
+			llvm::TargetMachine & tm)
+{
+  TimeReport::Timer timer(phase_optimize);
+  if (getJIT().optimizesModules())
+  {
+    llvm::legacy::FunctionPassManager pm(module.get());
+    addFunctionPasses(pm, tm);
+    pm.doInitialization();
+    for (auto & f : *module)
+    {
+      pm.run(f);
+    }
+    pm.doFinalization();
+  }
+  llvm::legacy::PassManager mpm;
+  addModulePasses(mpm, tm);
+  if (getOptLevel() == opt_fast_compile && hasImportedBodies(*module))
+  {
+    // the pipeline has no inliner, only the bodies imported for it are
+    // inlined (see inliner.h), then cleaned up like the rest
+    mpm.add(llvm::createAlwaysInlinerLegacyPass());
+    addFastCompilePasses(mpm);
+    mpm.add(llvm::createGlobalDCEPass());
+  }
+  mpm.run(*module);
+  return module;
+}
+
+llvm::Type * Codegen::llvmType(ValueType type)
+{
+  switch (type)
+  {
+  case type_bool:
+    return llvm::Type::getInt1Ty(the_context);
+  case type_int:
+    return llvm::Type::getInt64Ty(the_context);
+  default:
+    return llvm::Type::getDoubleTy(the_context);
+  }
+}
+
+llvm::Value * Codegen::convert(llvm::Value * v, ValueType from, ValueType to)
+{
+  if (from == to)
+  {
+    return v;
+  }
+  if (to == type_int)
+  {
+    return builder.CreateZExt(v, llvmType(to), "inttmp");
+  }
+  // convert bool 0/1 to double 0.0 or 1.0
+  return from == type_bool ?
+    builder.CreateUIToFP(v, llvmType(to), "booltmp") :
+    builder.CreateSIToFP(v, llvmType(to), "doubletmp");
+}
+
+llvm::Value * Codegen::createCondition(llvm::Value * v, ValueType type,
+				       const llvm::Twine & name)
+{
+  switch (type)
+  {
+  case type_bool:
+    return v;
+  case type_int:
+    return builder.CreateICmpNE(v, llvm::ConstantInt::get(v->getType(), 0),
+				name);
+  default:
+    return builder.CreateFCmpONE(v, llvm::ConstantFP::get(the_context, 
+							  llvm::APFloat(0.0)),
+				 name);
+  }
+}
+
+void Codegen::optimizeWholeProgram(llvm::Module & module)
+{
+  TimeReport::Timer timer(phase_optimize);
+  llvm::legacy::PassManager mpm;
+
+  // only the top-level expressions are entry points, everything else may be
+  // specialized, inlined or dropped
+  mpm.add(llvm::createInternalizePass([](const llvm::GlobalValue & gv) {
+	return gv.getName().startswith(Symbols::name(sym_anon_expr));
+      }));
+  if (getOptLevel() == opt_fast_compile)
+  {
+    mpm.add(llvm::createIPSCCPPass());
+    mpm.add(llvm::createGlobalDCEPass());
+    mpm.add(llvm::createArgumentPromotionPass());
+    mpm.add(llvm::createFunctionInliningPass());
+
+    // clean up after inlining with the per-function passes
+    addFastCompilePasses(mpm);
+  }
+  // from -O1 on the interprocedural passes are part of the module pipeline
+  // the JIT runs
+  mpm.add(llvm::createGlobalDCEPass());
+
+  mpm.run(module);
+}
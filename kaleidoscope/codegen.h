@@ -2,19 +2,93 @@
 #define _CODEGEN_H_
 
 #include "k_llvm.h"
-#include <map>
-#include <string>
+#include "kjit.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/Support/RecyclingAllocator.h"
+#include "options.h"
+#include "symbol.h"
+#include "types.h"
 
+// the local variables in scope: arguments and loop variables, an inner
+// binding shadowing an outer one of the same name until its scope ends. The
+// entries are recycled, a scope costs no allocation once the first functions
+// have been generated.
+typedef llvm::ScopedHashTable<
+  symbol_t, llvm::Value *, llvm::DenseMapInfo<symbol_t>,
+  llvm::RecyclingAllocator<llvm::BumpPtrAllocator,
+			   llvm::ScopedHashTableVal<symbol_t, llvm::Value *>>>
+  named_values_t;
+
+// IR generation state. It is thread local, so that definitions can be
+// compiled on several threads (see compile_pool.h) and compilers run on
+// threads of their own (see kcomp.h); the JIT and the settings belong to the
+// compiler.
 class Codegen {
  public:
-  static llvm::LLVMContext the_context;
-  static llvm::IRBuilder<> builder;
-  static std::unique_ptr<llvm::Module> the_module;
-  static std::map<std::string, llvm::Value *> named_values;
-  static std::unique_ptr<llvm::legacy::FunctionPassManager>fpm;
-  static std::unique_ptr<llvm::orc::KaleidoscopeJIT> jit;
+  static thread_local llvm::LLVMContext the_context;
+  static thread_local llvm::IRBuilder<> builder;
+  static thread_local std::unique_ptr<llvm::Module> the_module;
+  static thread_local named_values_t named_values;
+  // opens a scope of named_values, closed with the object
+  typedef named_values_t::ScopeTy Scope;
+  // functions of the_module by name, so lookups don't rehash the spelling
+  static thread_local llvm::DenseMap<symbol_t, llvm::Function *> functions;
+  // per-function passes run as functions are generated, null when the JIT
+  // optimizes modules itself (lazy mode, object cache)
+  static thread_local std::unique_ptr<llvm::legacy::FunctionPassManager>fpm;
+  // target machine the passes of the calling thread are set up for, null
+  // for the one of the JIT, which only the thread of the compiler uses: the
+  // compile pool threads have their own (see compile_pool.h)
+  static thread_local llvm::TargetMachine * target_machine;
+
+  // the JIT, the object cache (null without --cache-dir) and the settings of
+  // the compiler of the calling thread (see kcomp.h)
+  static KJIT & getJIT();
+  static KObjectCache * getObjectCache();
+  static OptLevel getOptLevel();
+  static FastMath getFastMath();
+  // target_machine, or the one of the JIT
+  static llvm::TargetMachine & getTargetMachine();
 
   static void initializeModuleAndPassManager();
+  // change the pipelines for the functions generated from now on
+  static void setOptLevel(OptLevel level);
+  static void initializeFunctionPassManager();
+  // fast-math flags of the floating point arithmetic generated from now on
+  static void setFastMath(FastMath mode);
+  // function attributes the backend reads: of the fast-math mode, and
+  // frame pointers for --perf and --gdb
+  static void setFunctionAttributes(llvm::Function & f);
+  // the pipelines of the optimization level, for the target of tm
+  static void addFunctionPasses(llvm::legacy::FunctionPassManager & fpm,
+				llvm::TargetMachine & tm);
+  static void addModulePasses(llvm::legacy::PassManagerBase & mpm,
+			      llvm::TargetMachine & tm);
+  // apply the backend configuration of the command line (CodeGenOpt level,
+  // instruction selector) to a target machine
+  static void configureBackend(llvm::TargetMachine & tm);
+  // the backend options LLVM keeps in globals, set once before any thread
+  // compiles
+  static void initializeBackendOptions();
+  // everything that makes the same IR compile to different code, the
+  // configuration of the object cache
+  static std::string getConfigurationId();
+  // the optimize transform of the JIT, runs the module passes, and the
+  // per-function passes too if the functions were not optimized as they
+  // were generated, set up for tm (that of the thread compiling module)
+  static std::unique_ptr<llvm::Module>
+    optimizeModule(std::unique_ptr<llvm::Module> module,
+		   llvm::TargetMachine & tm);
+  // IR type of the values of a type: i1, i64 or double
+  static llvm::Type * llvmType(ValueType type);
+  // v of type from widened to type to, bools to 0 or 1
+  static llvm::Value * convert(llvm::Value * v, ValueType from, ValueType to);
+  // the truth value of a condition of the given type: not equal to zero,
+  // and for doubles ordered
+  static llvm::Value * createCondition(llvm::Value * v, ValueType type,
+				       const llvm::Twine & name);
+  // interprocedural pipeline for a module holding a whole program
+  static void optimizeWholeProgram(llvm::Module & module);
 };
 
 #endif
@@ -0,0 +1,101 @@
+#include "compile_pool.h"
+#include "codegen.h"
+#include "inliner.h"
+#include "kcomp.h"
+#include "options.h"
+#include "time_report.h"
+#include <iostream>
+
+void CompilePool::submit(std::unique_ptr<FunctionAST> fn_ast, ASTArena & arena)
+{
+  // definitions compiled concurrently may call this one, the prototype has
+  // to be known before any of them is generated
+  fn_ast->registerPrototype();
+
+  auto job = llvm::make_unique<Job>();
+  job->fn_ast = std::move(fn_ast);
+  job->arena.adopt(arena);
+  job->item = TimeReport::currentItem();
+  job->stamp = PrototypeAST::currentStamp();
+  job->order = submitted++;
+  Job * j = job.get();
+  jobs.push_back(std::move(job));
+  pool.async([this, j] { compile(*j); });
+}
+
+void CompilePool::compile(Job & job)
+{
+  compiler.makeCurrent();
+  // the target machine of the JIT is not meant to be shared between threads
+  static thread_local std::unique_ptr<llvm::TargetMachine> tm;
+  if (!tm)
+  {
+    tm = KJIT::createTargetMachine();
+    Codegen::configureBackend(*tm);
+  }
+  // the passes too, TargetTransformInfo updates the target machine
+  Codegen::target_machine = tm.get();
+
+  TimeReport::setCurrentItem(job.item);
+  // the prototypes the definition would see compiled in order
+  PrototypeAST::see(job.stamp);
+  Codegen::initializeModuleAndPassManager();
+  llvm::Function * fn_ir = Options::flat_ast ? 
+    job.fn_ast->codegenFlat() : job.fn_ast->codegen();
+  if (fn_ir)
+  {
+    llvm::raw_string_ostream ir_stream(job.ir);
+    fn_ir->print(ir_stream);
+  }
+
+  // the jobs are started in order, the previous one is running or done
+  {
+    std::unique_lock<std::mutex> lock(turn_mutex);
+    turn_changed.wait(lock, [&] { return inliner_turn == job.order; });
+  }
+  if (fn_ir)
+  {
+    compiler.inliner.retain(job.fn_ast->getName(), *Codegen::the_module);
+    compiler.inliner.import(*Codegen::the_module, job.fn_ast->getName());
+  }
+  {
+    std::lock_guard<std::mutex> lock(turn_mutex);
+    ++inliner_turn;
+  }
+  turn_changed.notify_all();
+  if (!fn_ir)
+  {
+    return;
+  }
+  job.object = Codegen::getJIT().compileModule(std::move(Codegen::the_module), *tm);
+}
+
+void CompilePool::drain()
+{
+  pool.wait();
+  PrototypeAST::dropReplaced();
+  // linking is charged to the definitions, not to what drains them
+  unsigned item = TimeReport::currentItem();
+  std::vector<Job *> added;
+  for (auto & job : jobs)
+  {
+    if (job->object)
+    {
+      KCompiler::out() << "Parsed a function definition:" << std::endl;
+      KCompiler::err() << job->ir;
+      KCompiler::out() << std::endl;
+      TimeReport::setCurrentItem(job->item);
+      compiler.jit->addObject(std::move(job->object));
+      added.push_back(job.get());
+    }
+  }
+  // only once the whole batch is in the JIT: a caller compiled again must
+  // find the later definitions of the batch it calls
+  for (Job * job : added)
+  {
+    TimeReport::setCurrentItem(job->item);
+    compiler.inliner.redefined(job->fn_ast->getName());
+  }
+  TimeReport::setCurrentItem(item);
+  jobs.clear();
+}
@@ -0,0 +1,61 @@
+#ifndef _COMPILE_POOL_H_
+#define _COMPILE_POOL_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "k_llvm.h"
+#include "llvm/Support/ThreadPool.h"
+#include "arena.h"
+#include "ast.h"
+
+// Pool of threads compiling function definitions. Each definition is turned
+// into IR, optimized and compiled to an object file on one of the threads,
+// with its own LLVMContext, module and pass manager (the Codegen state
+// is thread local). drain() hands the objects to the JIT in source order,
+// so it must run before anything may call the new functions. The threads
+// work for the compiler that made the pool, whose JIT and prototypes the
+// definitions see, the prototypes as they were when the definition was
+// submitted. The definitions go through the inliner (see inliner.h) one at
+// a time in source order too, between codegen and the backend, so that
+// each one imports the bodies it would have seen compiled in order.
+class KCompiler;
+
+class CompilePool {
+ private:
+  struct Job {
+    std::unique_ptr<FunctionAST> fn_ast;
+    ASTArena arena;     // owns the expression nodes of fn_ast
+    std::string ir;     // printed IR of the function
+    std::unique_ptr<llvm::MemoryBuffer> object; // null if codegen failed
+    unsigned item;      // of the time report
+    unsigned stamp;     // prototypes registered when it was submitted
+    unsigned order;     // of submission, its turn in the inliner
+  };
+
+  KCompiler & compiler;
+  llvm::ThreadPool pool;
+  std::vector<std::unique_ptr<Job>> jobs; // submitted since the last drain
+  unsigned submitted = 0;
+  // order of the next job to go through the inliner
+  unsigned inliner_turn = 0;
+  std::mutex turn_mutex;
+  std::condition_variable turn_changed;
+
+  void compile(Job & job);
+
+ public:
+  CompilePool(KCompiler & compiler, unsigned threads)
+    :
+  compiler(compiler), pool(threads) {}
+
+  // compile fn_ast in the background, taking over its nodes from arena
+  void submit(std::unique_ptr<FunctionAST> fn_ast, ASTArena & arena);
+  // wait for the pending definitions and add them to the JIT
+  void drain();
+};
+
+#endif
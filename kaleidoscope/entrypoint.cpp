@@ -3,9 +3,14 @@
 
 #include "kcomp.h"
 #include "externs.h"
+#include "options.h"
 
-int main()
+int main(int argc, char ** argv)
 {
-  KCompiler::initialize_and_run();
-  return 0;
+  if (!Options::parse(argc, argv))
+  {
+    Options::usage(argv[0]);
+    return 1;
+  }
+  return KCompiler::initialize_and_run();
 }
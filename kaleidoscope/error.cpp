@@ -1,11 +1,12 @@
 #include "error.h"
 #include "ast.h"
+#include "kcomp.h"
 #include <iostream>
 #include <memory>
 
-std::unique_ptr<ExprAST> Error::log(const std::string str)
+ExprAST * Error::log(const std::string str)
 {
-  std::cerr << "LogError: " << str << std::endl;
+  KCompiler::err() << "LogError: " << str << std::endl;
   return nullptr;
 }
 
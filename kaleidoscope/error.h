@@ -7,7 +7,7 @@
 
 class Error {
  public:
-  static std::unique_ptr<ExprAST> log(const std::string str);
+  static ExprAST * log(const std::string str);
   static std::unique_ptr<PrototypeAST> logP(const std::string str);
   static llvm::Value * logV(const std::string str);
 };
@@ -9,3 +9,7 @@ extern "C" double printd(double X) {
   fprintf(stderr, "%f\n", X);
   return 0;
 }
+
+extern "C" void kcomp_print_result(double X) {
+  fprintf(stderr, "Evaluated to %g\n", X);
+}
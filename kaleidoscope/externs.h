@@ -4,3 +4,6 @@
 extern "C" double putchard(double X);
 /// printd - printf that takes a double prints it as "%f\n", returning 0.
 extern "C" double printd(double X);
+/// kcomp_print_result - prints the value of a top-level expression in
+/// programs compiled ahead of time.
+extern "C" void kcomp_print_result(double X);
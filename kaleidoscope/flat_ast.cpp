@@ -0,0 +1,334 @@
+#include "flat_ast.h"
+#include "ast.h"
+#include "codegen.h"
+#include "error.h"
+#include "time_report.h"
+
+//
+// Lowering of the tree AST to the flat encoding
+//
+
+flat_index_t NumberExprAST::flatten(FlatAST & flat)
+{
+  return flat.addNumber(val, type);
+}
+
+flat_index_t VariableExprAST::flatten(FlatAST & flat)
+{
+  return flat.addVariable(name, type);
+}
+
+flat_index_t BinaryExprAST::flatten(FlatAST & flat)
+{
+  flat_index_t l = lhs->flatten(flat);
+  flat_index_t r = rhs->flatten(flat);
+  return flat.addBinary(op, l, r, type);
+}
+
+flat_index_t CallExprAST::flatten(FlatAST & flat)
+{
+  llvm::SmallVector<flat_index_t, 8> arg_nodes;
+  for (ExprAST * arg : args)
+  {
+    arg_nodes.push_back(arg->flatten(flat));
+  }
+  return flat.addCall(callee, entry, arg_nodes, type);
+}
+
+flat_index_t IfExprAST::flatten(FlatAST & flat)
+{
+  flat_index_t c = Cond->flatten(flat);
+  flat_index_t t = Then->flatten(flat);
+  flat_index_t e = Else->flatten(flat);
+  return flat.addIf(c, t, e, type);
+}
+
+flat_index_t ForExprAST::flatten(FlatAST & flat)
+{
+  flat_index_t start_n = start->flatten(flat);
+  flat_index_t end_n = end->flatten(flat);
+  flat_index_t step_n = step ? step->flatten(flat) : FlatAST::none;
+  flat_index_t body_n = body->flatten(flat);
+  return flat.addFor(var_name, start_n, end_n, step_n, body_n, var_type, type);
+}
+
+llvm::Function * FunctionAST::codegenFlat()
+{
+  TimeReport::Timer timer(phase_codegen);
+  FlatAST flat;
+  body->flatten(flat);
+  return codegenFlat(flat);
+}
+
+llvm::Function * FunctionAST::codegenFlat(const FlatAST & flat)
+{
+  TimeReport::Timer timer(phase_codegen);
+  Codegen::Scope scope(Codegen::named_values);
+  llvm::Function * the_function = startFunction();
+  if (!the_function)
+  {
+    return nullptr;
+  }
+  return finishFunction(the_function, FlatCodegen(flat).codegen(flat.root()),
+			flat.type(flat.root()));
+}
+
+//
+// IR generation from the flat encoding, mirrors ast.cpp
+//
+
+llvm::Value * FlatCodegen::codegen(flat_index_t n)
+{
+  switch (ast.kind(n))
+  {
+  case FlatAST::Number:
+  {
+    if (ast.type(n) == type_int)
+    {
+      return llvm::ConstantInt::get(Codegen::llvmType(type_int), 
+				    int64_t(ast.number(n)));
+    }
+    return llvm::ConstantFP::get(Codegen::the_context, 
+				 llvm::APFloat(ast.number(n)));
+  }
+  case FlatAST::Variable:
+  {
+    llvm::Value * v = Codegen::named_values.lookup(ast.symbol(n));
+    if (!v)
+    {
+      Error::logV("Unknown variable name");
+    }
+    return v;
+  }
+  case FlatAST::Binary:
+  {
+    return codegenBinary(n);
+  }
+  case FlatAST::Call:
+  {
+    return codegenCall(n);
+  }
+  case FlatAST::If:
+  {
+    return codegenIf(n);
+  }
+  case FlatAST::For:
+  {
+    return codegenFor(n);
+  }
+  }
+  return Error::logV("Invalid flat AST node");
+}
+
+llvm::Value * FlatCodegen::codegenBinary(flat_index_t n)
+{
+  llvm::Value * l = codegen(ast.lhs(n));
+  llvm::Value * r = codegen(ast.rhs(n));
+  if (!l || !r)
+  {
+    return nullptr;	
+  }
+  ValueType lt = ast.type(ast.lhs(n)), rt = ast.type(ast.rhs(n));
+  // as in BinaryExprAST::codegen
+  ValueType operands = ast.op(n) == '<' ?
+    joinTypes(promoteType(lt), promoteType(rt)) : promoteType(ast.type(n));
+  l = Codegen::convert(l, lt, operands);
+  r = Codegen::convert(r, rt, operands);
+  bool ints = operands == type_int;
+  
+  switch(ast.op(n))
+  {
+  case '+':
+  {
+    return Codegen::convert(
+      ints ? Codegen::builder.CreateNSWAdd(l, r, "addtmp") :
+      Codegen::builder.CreateFAdd(l, r, "addtmp"), operands, ast.type(n));
+  }
+  case '-':
+  {
+    return Codegen::convert(
+      ints ? Codegen::builder.CreateNSWSub(l, r, "subtmp") :
+      Codegen::builder.CreateFSub(l, r, "subtmp"), operands, ast.type(n));
+  }
+  case '*':
+  {
+    return Codegen::convert(
+      ints ? Codegen::builder.CreateNSWMul(l, r, "multmp") :
+      Codegen::builder.CreateFMul(l, r, "multmp"), operands, ast.type(n));
+  }
+  case '<':
+  {
+    return Codegen::convert(
+      ints ? Codegen::builder.CreateICmpSLT(l, r, "cmptmp") :
+      Codegen::builder.CreateFCmpULT(l, r, "cmptmp"), type_bool, ast.type(n));
+  }
+  default: 
+  {
+    return Error::logV("Invalid binary operator");
+  }
+  }
+}
+
+llvm::Value * FlatCodegen::codegenCall(flat_index_t n)
+{
+  // look up the name in the global module table
+  llvm::Function * caleef = 
+    PrototypeAST::getFunction(ast.symbol(n), ast.entry(n), ast.type(n));
+  if (!caleef)
+  {
+    return Error::logV("Unknown function referenced");
+  }
+  llvm::ArrayRef<flat_index_t> args = ast.args(n);
+  // if argument mismatches
+  if (caleef->arg_size() != args.size())
+  {
+    return Error::logV("Incorrect # of arguments passed");
+  }
+  std::vector<llvm::Value *> args_v;
+  for (flat_index_t arg : args)
+  {
+    llvm::Value * v = codegen(arg);
+    if (!v)
+    {
+      return nullptr;
+    }
+    args_v.push_back(Codegen::convert(v, ast.type(arg), type_double));
+  }
+  return Codegen::builder.CreateCall(caleef, args_v, "calltmp");
+}
+
+llvm::Value * FlatCodegen::codegenIf(flat_index_t n)
+{
+  llvm::Value * condv = codegen(ast.cond(n));
+  if (!condv)
+  {
+    return nullptr;
+  }
+  // Convert condition to a bool by comarison non-equal to 0
+  condv = Codegen::createCondition(condv, ast.type(ast.cond(n)), "ifcond");
+
+  llvm::Function * the_function = Codegen::builder.GetInsertBlock()->getParent();
+  llvm::BasicBlock * then_bb = llvm::BasicBlock::Create(Codegen::the_context,
+                                                        "then",
+                                                        the_function);
+  llvm::BasicBlock * else_bb = llvm::BasicBlock::Create(Codegen::the_context,
+                                                        "else");
+  llvm::BasicBlock * merge_bb = llvm::BasicBlock::Create(Codegen::the_context,
+                                                         "ifcont");
+  Codegen::builder.CreateCondBr(condv, then_bb, else_bb);
+
+  // emit the then value
+  Codegen::builder.SetInsertPoint(then_bb);
+  llvm::Value * then_v = codegen(ast.thenExpr(n));
+  if (!then_v)
+  {
+    return nullptr;
+  }
+  then_v = Codegen::convert(then_v, ast.type(ast.thenExpr(n)), ast.type(n));
+  Codegen::builder.CreateBr(merge_bb);
+  then_bb = Codegen::builder.GetInsertBlock();
+
+  // emit the 'else' block
+  the_function->getBasicBlockList().push_back(else_bb);
+  Codegen::builder.SetInsertPoint(else_bb);
+  llvm::Value *else_v = codegen(ast.elseExpr(n));
+  if (!else_v)
+  {
+    return nullptr;
+  }
+  else_v = Codegen::convert(else_v, ast.type(ast.elseExpr(n)), ast.type(n));
+  Codegen::builder.CreateBr(merge_bb);
+  else_bb = Codegen::builder.GetInsertBlock();
+
+  // emit the merge block
+  the_function->getBasicBlockList().push_back(merge_bb);
+  Codegen::builder.SetInsertPoint(merge_bb);
+  llvm::PHINode * pn = 
+    Codegen::builder.CreatePHI(Codegen::llvmType(ast.type(n)), 2, "iftmp");
+  pn->addIncoming(then_v, then_bb);
+  pn->addIncoming(else_v, else_bb);
+  return pn;
+}
+
+llvm::Value * FlatCodegen::codegenFor(flat_index_t n)
+{
+  symbol_t var_name = ast.symbol(n);
+  ValueType var_type = ast.forVarType(n);
+  flat_index_t step = ast.forStep(n);
+
+  // emit the start code first, without 'variable' in scope
+  llvm::Value * start_val = codegen(ast.forStart(n));
+  if (!start_val)
+  {
+    return nullptr;
+  }
+  start_val = Codegen::convert(start_val, ast.type(ast.forStart(n)), var_type);
+  llvm::Function * the_function = 
+    Codegen::builder.GetInsertBlock()->getParent();
+  llvm::BasicBlock * pre_header_bb = Codegen::builder.GetInsertBlock();
+  llvm::BasicBlock * loop_bb = 
+    llvm::BasicBlock::Create(Codegen::the_context, "loop", the_function);
+  Codegen::builder.CreateBr(loop_bb);
+  Codegen::builder.SetInsertPoint(loop_bb);
+  
+  // an integer variable is an i64 induction variable, as in
+  // ForExprAST::codegen
+  llvm::PHINode * variable = 
+    Codegen::builder.CreatePHI(Codegen::llvmType(var_type), 2,
+			       Symbols::name(var_name));
+  variable->addIncoming(start_val, pre_header_bb);
+
+  // shadow any existing variable of the same name for the loop
+  Codegen::Scope scope(Codegen::named_values);
+  Codegen::named_values.insert(var_name, variable);
+
+  if (!codegen(ast.forBody(n)))
+  {
+    return nullptr;
+  }
+
+  // emit the step value, 1 if not specified
+  llvm::Value * step_val = nullptr;
+  if (step != FlatAST::none)
+  {
+    step_val = codegen(step);
+    if (!step_val)
+    {
+      return nullptr;
+    }
+    step_val = Codegen::convert(step_val, ast.type(step), var_type);
+  }
+  else if (var_type == type_int)
+  {
+    step_val = llvm::ConstantInt::get(Codegen::llvmType(var_type), 1);
+  }
+  else
+  {
+    step_val = llvm::ConstantFP::get(Codegen::the_context, 
+				     llvm::APFloat(1.0));
+  }
+  // bounded by the end condition, see ForExprAST::codegen
+  llvm::Value * next_var = var_type == type_int ?
+    Codegen::builder.CreateNSWAdd(variable, step_val, "nextvar") :
+    Codegen::builder.CreateFAdd(variable, step_val, "nextvar");
+
+  // compute the end condition
+  llvm::Value * end_cond = codegen(ast.forEnd(n));
+  if (!end_cond)
+  {
+    return nullptr;
+  }
+  end_cond = Codegen::createCondition(end_cond, ast.type(ast.forEnd(n)),
+				      "loopcond");
+  llvm::BasicBlock * loop_end_bb = Codegen::builder.GetInsertBlock();
+  llvm::BasicBlock * after_bb = 
+    llvm::BasicBlock::Create(Codegen::the_context,
+			     "afterloop",
+			     the_function);
+  Codegen::builder.CreateCondBr(end_cond, loop_bb, after_bb);
+  Codegen::builder.SetInsertPoint(after_bb);
+  variable->addIncoming(next_var, loop_end_bb);
+
+  // for expr always returns 0
+  return llvm::Constant::getNullValue(Codegen::llvmType(ast.type(n)));
+}
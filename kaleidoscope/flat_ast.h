@@ -0,0 +1,148 @@
+#ifndef _FLAT_AST_H_
+#define _FLAT_AST_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "k_llvm.h"
+#include "symbol.h"
+#include "types.h"
+
+typedef uint32_t flat_index_t;
+
+// FlatAST - compact, index based encoding of an expression tree.
+//
+// Nodes are stored struct-of-arrays style: node n has kind kinds[n], type
+// types[n] (see types.h) and up to three operand words a[n], b[n], c[n]
+// whose meaning depends on the kind.
+// Children are always added before their parent, so the root is the last
+// node and a walk touches memory mostly front to back.
+//
+//   Number    a = index into numbers
+//   Variable  a = symbol
+//   Binary    a = operator, b = lhs, c = rhs
+//   Call      a = callee symbol, b = entry point symbol in extra, followed
+//             by the arguments, c = # args
+//   If        a = condition, b = then, c = else
+//   For       a = variable symbol, b = first of start/end/step/body in extra
+//             (step is none when omitted), c = type of the variable
+class FlatAST {
+ public:
+  enum Kind : uint8_t { Number, Variable, Binary, Call, If, For };
+  static const flat_index_t none = ~flat_index_t(0);
+
+ private:
+  std::vector<Kind> kinds;
+  std::vector<ValueType> types;
+  std::vector<uint32_t> a, b, c;
+  std::vector<double> numbers;
+  std::vector<flat_index_t> extra; // out of line child lists
+
+  flat_index_t add(Kind kind, ValueType type, uint32_t x, uint32_t y, 
+		   uint32_t z)
+  {
+    kinds.push_back(kind);
+    types.push_back(type);
+    a.push_back(x);
+    b.push_back(y);
+    c.push_back(z);
+    return kinds.size() - 1;
+  }
+
+ public:
+  flat_index_t addNumber(double val, ValueType type)
+  {
+    numbers.push_back(val);
+    return add(Number, type, numbers.size() - 1, 0, 0);
+  }
+  flat_index_t addVariable(symbol_t name, ValueType type) 
+  { 
+    return add(Variable, type, name, 0, 0); 
+  }
+  flat_index_t addBinary(char op, flat_index_t lhs, flat_index_t rhs,
+			 ValueType type)
+  {
+    return add(Binary, type, static_cast<unsigned char>(op), lhs, rhs);
+  }
+  flat_index_t addCall(symbol_t callee, symbol_t entry,
+		       llvm::ArrayRef<flat_index_t> args, ValueType type)
+  {
+    flat_index_t first = extra.size();
+    extra.push_back(entry);
+    extra.insert(extra.end(), args.begin(), args.end());
+    return add(Call, type, callee, first, args.size());
+  }
+  flat_index_t addIf(flat_index_t cond, flat_index_t then_n, 
+		     flat_index_t else_n, ValueType type)
+  {
+    return add(If, type, cond, then_n, else_n);
+  }
+  flat_index_t addFor(symbol_t var_name, flat_index_t start, flat_index_t end,
+		      flat_index_t step, flat_index_t body, ValueType var_type,
+		      ValueType type)
+  {
+    flat_index_t first = extra.size();
+    extra.push_back(start);
+    extra.push_back(end);
+    extra.push_back(step);
+    extra.push_back(body);
+    return add(For, type, var_name, first, var_type);
+  }
+
+  void clear()
+  {
+    kinds.clear();
+    types.clear();
+    a.clear();
+    b.clear();
+    c.clear();
+    numbers.clear();
+    extra.clear();
+  }
+
+  size_t size() const { return kinds.size(); }
+  flat_index_t root() const { return kinds.size() - 1; }
+
+  Kind kind(flat_index_t n) const { return kinds[n]; }
+  ValueType type(flat_index_t n) const { return types[n]; }
+  double number(flat_index_t n) const { return numbers[a[n]]; }
+  symbol_t symbol(flat_index_t n) const { return a[n]; } // Variable/Call/For
+  char op(flat_index_t n) const { return static_cast<char>(a[n]); }
+  flat_index_t lhs(flat_index_t n) const { return b[n]; }
+  flat_index_t rhs(flat_index_t n) const { return c[n]; }
+  symbol_t entry(flat_index_t n) const { return extra[b[n]]; } // Call
+  llvm::ArrayRef<flat_index_t> args(flat_index_t n) const
+  {
+    return llvm::makeArrayRef(extra).slice(b[n] + 1, c[n]);
+  }
+  flat_index_t cond(flat_index_t n) const { return a[n]; }
+  flat_index_t thenExpr(flat_index_t n) const { return b[n]; }
+  flat_index_t elseExpr(flat_index_t n) const { return c[n]; }
+  flat_index_t forStart(flat_index_t n) const { return extra[b[n]]; }
+  flat_index_t forEnd(flat_index_t n) const { return extra[b[n] + 1]; }
+  flat_index_t forStep(flat_index_t n) const { return extra[b[n] + 2]; }
+  flat_index_t forBody(flat_index_t n) const { return extra[b[n] + 3]; }
+  ValueType forVarType(flat_index_t n) const 
+  { 
+    return static_cast<ValueType>(c[n]); 
+  }
+};
+
+// FlatCodegen - lowers a FlatAST to IR with a switch over node kinds instead
+// of a virtual call per node; emits the same IR as ExprAST::codegen
+class FlatCodegen {
+ private:
+  const FlatAST & ast;
+
+  llvm::Value * codegenBinary(flat_index_t n);
+  llvm::Value * codegenCall(flat_index_t n);
+  llvm::Value * codegenIf(flat_index_t n);
+  llvm::Value * codegenFor(flat_index_t n);
+
+ public:
+  FlatCodegen(const FlatAST & ast) : ast(ast) {}
+
+  llvm::Value * codegen(flat_index_t n);
+};
+
+#endif
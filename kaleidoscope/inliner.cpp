@@ -0,0 +1,199 @@
+#include "inliner.h"
+#include "codegen.h"
+#include "kcomp.h"
+#include "options.h"
+#include "time_report.h"
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <vector>
+
+Inliner & Inliner::instance()
+{
+  return KCompiler::current().inliner;
+}
+
+bool Inliner::enabled()
+{
+  return Options::inline_threshold > 0 && !Options::lazy;
+}
+
+// a function of m calling itself
+static bool isRecursive(const llvm::Module & m)
+{
+  for (auto & f : m)
+  {
+    for (auto * user : f.users())
+    {
+      auto * call = llvm::dyn_cast<llvm::CallInst>(user);
+      if (call && call->getFunction() == &f)
+      {
+	return true;
+      }
+    }
+  }
+  return false;
+}
+
+void Inliner::retain(symbol_t name, const llvm::Module & m)
+{
+  if (!enabled())
+  {
+    return;
+  }
+  Body body;
+  {
+    llvm::raw_string_ostream out(body.bitcode);
+    llvm::WriteBitcodeToFile(m, out);
+  }
+  body.size = 0;
+  for (auto & f : m)
+  {
+    for (auto & bb : f)
+    {
+      body.size += bb.size();
+    }
+  }
+  body.recursive = isRecursive(m);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  body.version = ++versions;
+  bodies[Symbols::name(name)] = std::move(body);
+}
+
+// the retained module of a definition, read into the context of the thread
+static std::unique_ptr<llvm::Module> readModule(const std::string & bitcode,
+						llvm::StringRef name,
+						llvm::LLVMContext & context)
+{
+  auto m = llvm::parseBitcodeFile(llvm::MemoryBufferRef(bitcode, name),
+				  context);
+  if (!m)
+  {
+    // written by retain(), not expected
+    llvm::consumeError(m.takeError());
+    return nullptr;
+  }
+  return std::move(*m);
+}
+
+void Inliner::import(llvm::Module & m, symbol_t name)
+{
+  if (!enabled() || Codegen::getOptLevel() == opt_none)
+  {
+    return;
+  }
+  TimeReport::Timer timer(phase_optimize);
+  llvm::StringMap<unsigned> imports;
+  // the imported bodies may call further definitions worth importing
+  bool linked = true;
+  while (linked)
+  {
+    linked = false;
+    // linking replaces the declarations, keep the names only
+    std::vector<std::string> callees;
+    for (auto & f : m)
+    {
+      if (f.isDeclaration() && !imports.count(f.getName()))
+      {
+	callees.push_back(f.getName().str());
+      }
+    }
+    for (auto & callee : callees)
+    {
+      std::string bitcode;
+      unsigned version;
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto bi = bodies.find(callee);
+	if (bi == bodies.end() || bi->second.recursive ||
+	    bi->second.size > Options::inline_threshold)
+	{
+	  continue;
+	}
+	bitcode = bi->second.bitcode;
+	version = bi->second.version;
+      }
+      auto src = readModule(bitcode, callee, m.getContext());
+      llvm::Function * decl = m.getFunction(callee);
+      llvm::Function * def = src ? src->getFunction(callee) : nullptr;
+      if (!def || !decl || def->getFunctionType() != decl->getFunctionType())
+      {
+	// not expected, a redefinition keeps the number of arguments (see
+	// Parser::handleDefinition), the call goes to the stub
+	continue;
+      }
+      for (auto & f : *src)
+      {
+	if (f.isDeclaration())
+	{
+	  continue;
+	}
+	// the typed entries are internal, they become private copies
+	if (f.hasExternalLinkage())
+	{
+	  f.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+	}
+	f.addFnAttr(llvm::Attribute::AlwaysInline);
+      }
+      if (llvm::Linker::linkModules(m, std::move(src),
+				    llvm::Linker::LinkOnlyNeeded))
+      {
+	continue;
+      }
+      imports[callee] = version;
+      ++num_imported;
+      linked = true;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto bi = bodies.find(Symbols::name(name));
+  if (bi != bodies.end())
+  {
+    bi->second.imports = std::move(imports);
+  }
+}
+
+void Inliner::redefined(symbol_t name)
+{
+  if (!enabled())
+  {
+    return;
+  }
+  // name and bitcode of the definitions that inlined an older version
+  std::vector<std::pair<std::string, std::string>> stale;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto bi = bodies.find(Symbols::name(name));
+    if (bi == bodies.end())
+    {
+      return;
+    }
+    unsigned version = bi->second.version;
+    for (auto & body : bodies)
+    {
+      auto ii = body.second.imports.find(Symbols::name(name));
+      if (ii != body.second.imports.end() && ii->second != version)
+      {
+	stale.emplace_back(body.first().str(), body.second.bitcode);
+      }
+    }
+  }
+  for (auto & caller : stale)
+  {
+    auto m = readModule(caller.second, caller.first, Codegen::the_context);
+    if (!m)
+    {
+      continue;
+    }
+    import(*m, Symbols::intern(caller.first));
+    // its stub moves to the new module, the old one is removed
+    Codegen::getJIT().addModule(std::move(m));
+    ++num_recompiled;
+  }
+}
@@ -0,0 +1,63 @@
+#ifndef _INLINER_H_
+#define _INLINER_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "k_llvm.h"
+#include "llvm/ADT/StringMap.h"
+#include "symbol.h"
+
+// Inliner - inlining across the modules of the REPL. Every definition goes
+// to the JIT in a module of its own, so a later function only sees a
+// declaration of it and calls it through its stub (see kjit.h). The inliner
+// keeps the optimized IR of each definition, as bitcode so that any thread
+// can read it into its own context, and before a module is compiled it
+// imports the bodies of the small definitions the module calls as
+// available_externally, always-inline copies: the optimizer inlines them and
+// the backend emits no code for them.
+//
+// A caller that inlined a definition would not see a redefinition of it, so
+// redefined() compiles the callers that imported an older version again from
+// their retained IR. Each compiler (see kcomp.h) has its own definitions.
+class Inliner {
+  struct Body {
+    std::string bitcode;   // module of the definition, before any import
+    unsigned size;         // instructions of its functions
+    bool recursive;        // never inlined, only the calls into it would be
+    unsigned version;      // of the name, every definition gets a new one
+    llvm::StringMap<unsigned> imports; // version of each body imported
+  };
+
+  // the latest definition of each name
+  llvm::StringMap<Body> bodies;
+  unsigned versions = 0;
+  // definitions are retained and imported on the compile threads
+  std::mutex mutex;
+  std::atomic<unsigned> num_imported{0};
+  std::atomic<unsigned> num_recompiled{0};
+
+ public:
+  // the inliner of the compiler of the calling thread
+  static Inliner & instance();
+
+  // the definitions are retained (not in lazy mode, the compile callbacks
+  // split the modules per function)
+  static bool enabled();
+
+  // keep the module of the definition of name, just generated, for later
+  // imports
+  void retain(symbol_t name, const llvm::Module & m);
+  // link the bodies m may inline into m, m being the module of the
+  // definition of name or of a top-level expression
+  void import(llvm::Module & m, symbol_t name);
+  // name was just redefined: compile again, and add to the JIT, the
+  // definitions that inlined a previous version of it
+  void redefined(symbol_t name);
+
+  unsigned getImported() const { return num_imported; }
+  unsigned getRecompiled() const { return num_recompiled; }
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include "interp.h"
+#include "ast.h"
+#include "codegen.h"
+#include "error.h"
+
+bool Interpreter::worthCompiling(const FlatAST & ast, unsigned threshold)
+{
+  if (ast.size() > threshold)
+  {
+    return true;
+  }
+  for (flat_index_t n = 0, e = ast.size(); n != e; ++n)
+  {
+    if (ast.kind(n) == FlatAST::For)
+    {
+      return true;
+    }
+    if (ast.kind(n) == FlatAST::Call && ast.args(n).size() > max_args)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Interpreter::eval(flat_index_t n, double & result)
+{
+  // evaluation order and floating point semantics follow the IR emitted by
+  // codegen(): operands left to right, '<' is an unordered compare and a
+  // condition holds when it is ordered and not equal to 0.0
+  switch (ast.kind(n))
+  {
+  case FlatAST::Number:
+  {
+    result = ast.number(n);
+    return true;
+  }
+  case FlatAST::Variable:
+  {
+    for (auto it = vars.rbegin(), e = vars.rend(); it != e; ++it)
+    {
+      if (it->first == ast.symbol(n))
+      {
+	result = it->second;
+	return true;
+      }
+    }
+    Error::log("Unknown variable name");
+    return false;
+  }
+  case FlatAST::Binary:
+  {
+    double l, r;
+    if (!eval(ast.lhs(n), l) || !eval(ast.rhs(n), r))
+    {
+      return false;
+    }
+    switch (ast.op(n))
+    {
+    case '+':
+      result = l + r;
+      return true;
+    case '-':
+      result = l - r;
+      return true;
+    case '*':
+      result = l * r;
+      return true;
+    case '<':
+      result = !(l >= r) ? 1.0 : 0.0;
+      return true;
+    default:
+      Error::log("Invalid binary operator");
+      return false;
+    }
+  }
+  case FlatAST::Call:
+  {
+    return evalCall(n, result);
+  }
+  case FlatAST::If:
+  {
+    double c;
+    if (!eval(ast.cond(n), c))
+    {
+      return false;
+    }
+    return eval((c < 0.0 || c > 0.0) ? ast.thenExpr(n) : ast.elseExpr(n), 
+		result);
+  }
+  case FlatAST::For:
+  {
+    return evalFor(n, result);
+  }
+  }
+  Error::log("Invalid flat AST node");
+  return false;
+}
+
+bool Interpreter::evalCall(flat_index_t n, double & result)
+{
+  symbol_t callee = ast.symbol(n);
+  llvm::ArrayRef<flat_index_t> args = ast.args(n);
+
+  auto proto = PrototypeAST::find(callee);
+  if (!proto)
+  {
+    Error::log("Unknown function referenced");
+    return false;
+  }
+  if (proto->getargs().size() != args.size())
+  {
+    Error::log("Incorrect # of arguments passed");
+    return false;
+  }
+  if (args.size() > max_args)
+  {
+    Error::log("Too many arguments for the interpreter");
+    return false;
+  }
+
+  double v[max_args];
+  for (unsigned i = 0, e = args.size(); i != e; ++i)
+  {
+    if (!eval(args[i], v[i]))
+    {
+      return false;
+    }
+  }
+
+  uint64_t & addr = callees[callee];
+  if (!addr)
+  {
+    auto sym = Codegen::getJIT().findSymbol(Symbols::name(callee).str());
+    if (sym)
+    {
+      addr = cantFail(sym.getAddress());
+    }
+    if (!addr)
+    {
+      Error::log("Unresolved function '" + Symbols::name(callee).str() + "'");
+      return false;
+    }
+  }
+
+  // every function takes and returns doubles, dispatch on the arity
+  typedef double d;
+  switch (args.size())
+  {
+  case 0:
+    result = ((d(*)())(intptr_t)addr)();
+    break;
+  case 1:
+    result = ((d(*)(d))(intptr_t)addr)(v[0]);
+    break;
+  case 2:
+    result = ((d(*)(d, d))(intptr_t)addr)(v[0], v[1]);
+    break;
+  case 3:
+    result = ((d(*)(d, d, d))(intptr_t)addr)(v[0], v[1], v[2]);
+    break;
+  case 4:
+    result = ((d(*)(d, d, d, d))(intptr_t)addr)(v[0], v[1], v[2], v[3]);
+    break;
+  case 5:
+    result = ((d(*)(d, d, d, d, d))(intptr_t)addr)(v[0], v[1], v[2], v[3], 
+						   v[4]);
+    break;
+  case 6:
+    result = ((d(*)(d, d, d, d, d, d))(intptr_t)addr)(v[0], v[1], v[2], v[3],
+						      v[4], v[5]);
+    break;
+  }
+  return true;
+}
+
+bool Interpreter::evalFor(flat_index_t n, double & result)
+{
+  double var;
+  if (!eval(ast.forStart(n), var))
+  {
+    return false;
+  }
+  vars.push_back(std::make_pair(ast.symbol(n), var));
+  while (1)
+  {
+    double ignored, step = 1.0, end;
+    if (!eval(ast.forBody(n), ignored) ||
+	(ast.forStep(n) != FlatAST::none && !eval(ast.forStep(n), step)) ||
+	!eval(ast.forEnd(n), end))
+    {
+      vars.pop_back();
+      return false;
+    }
+    vars.back().second += step;
+    if (!(end < 0.0 || end > 0.0))
+    {
+      break;
+    }
+  }
+  vars.pop_back();
+  result = 0.0;
+  return true;
+}
@@ -0,0 +1,37 @@
+#ifndef _INTERP_H_
+#define _INTERP_H_
+
+#include "flat_ast.h"
+#include "llvm/ADT/SmallVector.h"
+
+// Interpreter - evaluates one-shot top-level expressions directly from
+// their flat encoding instead of building, optimizing and JIT-linking an
+// __anon_expr module. Calls go straight to the JIT-ed (or host) callee.
+class Interpreter {
+ private:
+  const FlatAST & ast;
+  // for loop variables in scope, innermost last
+  llvm::SmallVector<std::pair<symbol_t, double>, 4> vars;
+  // callee addresses resolved so far
+  llvm::DenseMap<symbol_t, uint64_t> callees;
+
+  bool eval(flat_index_t n, double & result);
+  bool evalCall(flat_index_t n, double & result);
+  bool evalFor(flat_index_t n, double & result);
+
+ public:
+  // calls with more arguments than this are always compiled
+  static const unsigned max_args = 6;
+
+  Interpreter(const FlatAST & ast) : ast(ast) {}
+
+  // returns true when the expression should rather be compiled: it has
+  // loops, is larger than threshold nodes or makes calls the interpreter
+  // cannot dispatch. A threshold of 0 always compiles.
+  static bool worthCompiling(const FlatAST & ast, unsigned threshold);
+
+  // evaluate the root of the expression, errors are logged
+  bool run(double & result) { return eval(ast.root(), result); }
+};
+
+#endif
@@ -0,0 +1,508 @@
+// kbench - compiler throughput benchmarks
+//
+// Measures the throughput of the front end on synthetic sources of a
+// controlled size and shape (deeply nested expressions, many small
+// definitions, long argument lists): lexer tokens, parser AST nodes,
+// nodes analyzed (constant folding and type inference, as kcomp does
+// before codegen) and IR instructions generated per second. Then compares
+// IR generation through the tree AST (virtual codegen() per node) with
+// the flat AST (switch based walker over contiguous arrays) on a single
+// function whose body has a configurable number of nodes, then
+// measures machine code generation per function under each backend
+// configuration (see --backend and --isel of kcomp), and the run time of
+// a polynomial compiled with each fast-math mode (--fast-math).
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "kcomp.h"
+
+namespace {
+
+typedef std::chrono::steady_clock bench_clock_t;
+
+double secondsSince(bench_clock_t::time_point start)
+{
+  return std::chrono::duration<double>(bench_clock_t::now() - start).count();
+}
+
+// balanced binary expression with 2^depth leaves, so that neither the
+// parser nor the walkers recurse deeper than depth
+void genBalanced(std::string & out, unsigned depth, unsigned & leaf)
+{
+  if (depth == 0)
+  {
+    static const char * const leaves[] = { "x", "y", "1.5", "z" };
+    out += leaves[leaf++ % 4];
+    return;
+  }
+  static const char ops[] = { '+', '*', '-', '<' };
+  out += '(';
+  genBalanced(out, depth - 1, leaf);
+  out += ops[depth % 4];
+  genBalanced(out, depth - 1, leaf);
+  out += ')';
+}
+
+// the parser of the compiler main() sets up
+Parser & parser()
+{
+  return KCompiler::current().parser;
+}
+
+std::unique_ptr<FunctionAST> parse(const std::string & source)
+{
+  Lexer::instance()->setInputString(source);
+  parser().getNextToken();
+  return parser().parseDefinition();
+}
+
+struct Result {
+  double codegen = 1e30;
+};
+
+// count definitions, each an operand in depth nested parentheses:
+// ((((x+1)*2)-3)<4)...
+std::string genNested(unsigned count, unsigned depth)
+{
+  static const char ops[] = { '+', '*', '-', '<' };
+  std::string out;
+  for (unsigned i = 0; i < count; ++i)
+  {
+    out += "def nested" + std::to_string(i) + "(x y) ";
+    out.append(depth, '(');
+    out += i % 2 ? "x" : "y";
+    for (unsigned d = 0; d < depth; ++d)
+    {
+      out += ops[d % 4];
+      out += std::to_string(d + i);
+      out += ')';
+    }
+    out += '\n';
+  }
+  return out;
+}
+
+// count one-line definitions
+std::string genSmall(unsigned count)
+{
+  std::string out;
+  for (unsigned i = 0; i < count; ++i)
+  {
+    out += "def small" + std::to_string(i) + "(x y) x*y+" + std::to_string(i) +
+      "\n";
+  }
+  return out;
+}
+
+// count definitions of args parameters, each passing them on reversed to
+// the previous one
+std::string genWide(unsigned count, unsigned args)
+{
+  std::string params;
+  for (unsigned a = 0; a < args; ++a)
+  {
+    params += (a ? " a" : "a") + std::to_string(a);
+  }
+  std::string out;
+  for (unsigned i = 0; i < count; ++i)
+  {
+    out += "def wide" + std::to_string(i) + "(" + params + ") ";
+    if (i == 0)
+    {
+      for (unsigned a = 0; a < args; ++a)
+      {
+	out += (a ? "+a" : "a") + std::to_string(a);
+      }
+    }
+    else
+    {
+      out += "wide" + std::to_string(i - 1) + "(";
+      for (unsigned a = args; a-- > 0; )
+      {
+	out += "a" + std::to_string(a) + (a ? ", " : "");
+      }
+      out += ")";
+    }
+    out += '\n';
+  }
+  return out;
+}
+
+struct FrontendResult {
+  size_t tokens = 0;
+  size_t nodes = 0;
+  size_t instructions = 0;
+  double lex = 1e30;
+  double parse = 1e30;    // lexing included, the parser pulls the tokens
+  double analyze = 1e30;
+  double codegen = 1e30;
+};
+
+// best of reps runs of each front-end stage over source, a sequence of
+// definitions, after a warm-up run; false if it does not compile
+bool benchFrontend(const std::string & source, unsigned reps,
+		   FrontendResult & res)
+{
+  for (unsigned r = 0; r <= reps; ++r)
+  {
+    if (r == 1)
+    {
+      // the first run only warms up the caches and the allocators
+      res = FrontendResult();
+    }
+    Lexer::instance()->setInputString(source);
+    size_t tokens = 0;
+    auto start = bench_clock_t::now();
+    while (Lexer::instance()->getToken() != tok_eof)
+    {
+      ++tokens;
+    }
+    res.lex = std::min(res.lex, secondsSince(start));
+    res.tokens = tokens;
+
+    // the trees are kept for codegen, like a batch compilation would
+    std::vector<std::unique_ptr<FunctionAST>> defs;
+    size_t nodes = parser().getArena().getNumNodes();
+    Lexer::instance()->setInputString(source);
+    start = bench_clock_t::now();
+    parser().getNextToken();
+    while (parser().getCurrentToken() == tok_def)
+    {
+      auto fn_ast = parser().parseDefinition();
+      if (!fn_ast)
+      {
+	return false;
+      }
+      defs.push_back(std::move(fn_ast));
+    }
+    res.parse = std::min(res.parse, secondsSince(start));
+    res.nodes = parser().getArena().getNumNodes() - nodes;
+
+    // folding and typing, which codegen relies on like in kcomp
+    start = bench_clock_t::now();
+    for (auto & fn_ast : defs)
+    {
+      parser().analyze(*fn_ast);
+    }
+    res.analyze = std::min(res.analyze, secondsSince(start));
+
+    // IR emission only, not the function pass pipeline
+    Codegen::initializeModuleAndPassManager();
+    Codegen::fpm.reset();
+    start = bench_clock_t::now();
+    for (auto & fn_ast : defs)
+    {
+      if (!fn_ast->codegen())
+      {
+	return false;
+      }
+    }
+    res.codegen = std::min(res.codegen, secondsSince(start));
+    size_t instructions = 0;
+    for (auto & f : *Codegen::the_module)
+    {
+      for (auto & bb : f)
+      {
+	instructions += bb.size();
+      }
+    }
+    res.instructions = instructions;
+    defs.clear();
+    parser().getArena().reset();
+  }
+  return true;
+}
+
+struct BackendConfig {
+  const char * name;
+  unsigned backend_opt;
+  ISel isel;
+};
+
+// machine code generation of count functions, one module each like in the
+// REPL, returns the average time per function in seconds
+double benchBackend(const BackendConfig & config, unsigned count, 
+		    unsigned depth)
+{
+  Options::backend_opt = config.backend_opt;
+  Options::isel = config.isel;
+  std::unique_ptr<llvm::TargetMachine> tm = KJIT::createTargetMachine();
+  Codegen::configureBackend(*tm);
+
+  KJIT::BackendStats stats;
+  for (unsigned i = 0; i < count; ++i)
+  {
+    std::string source = "def f" + std::to_string(i) + "(x y z) ";
+    unsigned leaf = i;
+    genBalanced(source, depth, leaf);
+
+    Codegen::initializeModuleAndPassManager();
+    auto fn_ast = parse(source);
+    if (!fn_ast || !fn_ast->codegen())
+    {
+      return 0;
+    }
+    parser().getArena().reset();
+    KJIT::TimedCompiler(*tm, stats)(*Codegen::the_module);
+  }
+  return stats.nanoseconds / 1e9 / stats.functions;
+}
+
+// Horner evaluation of a polynomial of the given degree, a chain of
+// dependent multiplies and adds that FMA contraction halves
+std::string genPolynomial(const std::string & name, unsigned degree)
+{
+  std::string body = "0.5";
+  for (unsigned i = 1; i <= degree; ++i)
+  {
+    body = "(" + body + ")*x" + (i % 2 ? "+" : "-") + std::to_string(i) +
+      ".25";
+  }
+  return "def " + name + "(x) " + body;
+}
+
+// average time of a call to the polynomial compiled with mode, in seconds
+double benchFastMath(FastMath mode, unsigned degree, unsigned calls)
+{
+  std::string name = "poly" + Options::fastMathName(mode);
+  Codegen::setFastMath(mode);
+  Codegen::initializeModuleAndPassManager();
+  auto fn_ast = parse(genPolynomial(name, degree));
+  if (!fn_ast || !fn_ast->codegen())
+  {
+    return 0;
+  }
+  parser().getArena().reset();
+  Codegen::getJIT().addModule(std::move(Codegen::the_module));
+  auto sym = Codegen::getJIT().findSymbol(name);
+  if (!sym)
+  {
+    return 0;
+  }
+  double (*poly)(double) = 
+    (double(*)(double))(intptr_t)cantFail(sym.getAddress());
+
+  double sum = 0;
+  auto start = bench_clock_t::now();
+  for (unsigned i = 0; i < calls; ++i)
+  {
+    sum += poly(i * 1e-6);
+  }
+  double seconds = secondsSince(start);
+  // keep the calls
+  if (sum == 42.0)
+  {
+    std::cout << sum << std::endl;
+  }
+  return seconds / calls;
+}
+
+}
+
+int main(int argc, char ** argv)
+{
+  unsigned depth = 17; // 2^17 leaves, ~262k nodes
+  unsigned reps = 5;
+  unsigned functions = 200;   // for the backend benchmark
+  unsigned fn_depth = 7;
+  unsigned degree = 16;       // for the fast-math benchmark
+  unsigned calls = 10000000;
+  unsigned defs = 2000;       // per shape of the front-end benchmark
+  unsigned nesting = 64;
+  unsigned wide_args = 64;
+  bool frontend_only = false;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--depth" && i + 1 < argc)
+    {
+      depth = atoi(argv[++i]);
+    }
+    else if (arg == "--reps" && i + 1 < argc)
+    {
+      reps = atoi(argv[++i]);
+    }
+    else if (arg == "--functions" && i + 1 < argc)
+    {
+      functions = atoi(argv[++i]);
+    }
+    else if (arg == "--function-depth" && i + 1 < argc)
+    {
+      fn_depth = atoi(argv[++i]);
+    }
+    else if (arg == "--degree" && i + 1 < argc)
+    {
+      degree = atoi(argv[++i]);
+    }
+    else if (arg == "--calls" && i + 1 < argc)
+    {
+      calls = atoi(argv[++i]);
+    }
+    else if (arg == "--defs" && i + 1 < argc)
+    {
+      defs = atoi(argv[++i]);
+    }
+    else if (arg == "--nesting" && i + 1 < argc)
+    {
+      nesting = atoi(argv[++i]);
+    }
+    else if (arg == "--args" && i + 1 < argc)
+    {
+      wide_args = atoi(argv[++i]);
+    }
+    else if (arg == "--frontend")
+    {
+      frontend_only = true;
+    }
+    else
+    {
+      std::cerr << "usage: " << argv[0] << " [--depth N] [--reps N]"
+		<< " [--functions N] [--function-depth N] [--degree N]"
+		<< " [--calls N] [--defs N] [--nesting N] [--args N]"
+		<< " [--frontend]" << std::endl;
+      return 1;
+    }
+  }
+
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
+  Codegen::initializeBackendOptions();
+  KCompiler compiler;
+  compiler.makeCurrent();
+  compiler.jit = llvm::make_unique<KJIT>(false, Codegen::optimizeModule);
+
+  struct Shape {
+    std::string name;
+    std::string source;
+  };
+  // about as many tokens of each shape, the small definitions are 16 times
+  // as many
+  const Shape shapes[] = {
+    { std::to_string(defs) + " definitions nested " + std::to_string(nesting) +
+      " deep", genNested(defs, nesting) },
+    { std::to_string(defs * 16) + " small definitions", genSmall(defs * 16) },
+    { std::to_string(defs) + " definitions of " + std::to_string(wide_args) +
+      " arguments", genWide(defs, wide_args) },
+  };
+  std::cout << "front end, best of " << reps << ":" << std::endl;
+  for (auto & shape : shapes)
+  {
+    FrontendResult res;
+    if (!benchFrontend(shape.source, reps, res))
+    {
+      return 1;
+    }
+    std::cout << "  " << shape.name << ":" << std::endl
+	      << "    lex " << res.tokens / res.lex / 1e6 << " Mtokens/s, parse "
+	      << res.nodes / res.parse / 1e6 << " Mnodes/s, analyze "
+	      << res.nodes / res.analyze / 1e6 << " Mnodes/s, codegen "
+	      << res.instructions / res.codegen / 1e6 << " Minstructions/s"
+	      << std::endl
+	      << "    (" << res.tokens << " tokens, " << res.nodes << " nodes, "
+	      << res.instructions << " instructions)" << std::endl;
+  }
+  if (frontend_only)
+  {
+    return 0;
+  }
+
+  std::string source = "def big(x y z) ";
+  unsigned leaf = 0;
+  genBalanced(source, depth, leaf);
+
+  // the parser builds the same tree for both walkers, the flat encoding is
+  // lowered from it, so only the IR emission is compared; flattening is
+  // timed on its own as the extra cost --flat pays
+  Result tree, flat;
+  double parse_time = 1e30;
+  double flatten_time = 1e30;
+  size_t nodes = 0;
+  for (unsigned r = 0; r < reps; ++r)
+  {
+    size_t before = parser().getArena().getNumNodes();
+    auto start = bench_clock_t::now();
+    auto fn_ast = parse(source);
+    parse_time = std::min(parse_time, secondsSince(start));
+    if (!fn_ast)
+    {
+      return 1;
+    }
+    nodes = parser().getArena().getNumNodes() - before;
+
+    FlatAST flat_body;
+    start = bench_clock_t::now();
+    fn_ast->flattenBody(flat_body);
+    flatten_time = std::min(flatten_time, secondsSince(start));
+
+    for (int use_flat = 0; use_flat < 2; ++use_flat)
+    {
+      Result & res = use_flat ? flat : tree;
+
+      // measure IR emission only, not the function pass pipeline
+      Codegen::initializeModuleAndPassManager();
+      Codegen::fpm.reset();
+
+      start = bench_clock_t::now();
+      llvm::Function * fn = 
+	use_flat ? fn_ast->codegenFlat(flat_body) : fn_ast->codegen();
+      res.codegen = std::min(res.codegen, secondsSince(start));
+      if (!fn)
+      {
+	return 1;
+      }
+    }
+    parser().getArena().reset();
+  }
+
+  std::cout << "body nodes: " << nodes << ", best of " << reps << std::endl
+	    << "parse: " << parse_time * 1e3 << " ms, flatten: "
+	    << flatten_time * 1e3 << " ms" << std::endl;
+  for (int use_flat = 0; use_flat < 2; ++use_flat)
+  {
+    Result & res = use_flat ? flat : tree;
+    std::cout << (use_flat ? "flat" : "tree") 
+	      << " codegen: " << res.codegen * 1e3 << " ms, "
+	      << nodes / res.codegen / 1e6 << " Mnodes/s" << std::endl;
+  }
+
+  static const BackendConfig configs[] = {
+    { "fast (FastISel, -O0 backend)", 0, isel_fast },
+    { "default (SelectionDAG)", 2, isel_default },
+    { "aggressive (SelectionDAG)", 3, isel_default },
+    { "GlobalISel", 2, isel_global },
+  };
+  std::cout << "machine code, " << functions << " functions of " 
+	    << (1u << fn_depth) << " leaves:" << std::endl;
+  for (auto & config : configs)
+  {
+    double seconds = benchBackend(config, functions, fn_depth);
+    if (seconds == 0)
+    {
+      return 1;
+    }
+    std::cout << "  " << config.name << ": " << seconds * 1e6 
+	      << " us per function" << std::endl;
+  }
+
+  // the code runs on the host CPU, so contraction produces FMAs where it
+  // has them
+  std::cout << "fast math, polynomial of degree " << degree << ", " 
+	    << calls << " calls:" << std::endl;
+  for (FastMath mode : { fm_off, fm_contract, fm_fast })
+  {
+    double seconds = benchFastMath(mode, degree, calls);
+    if (seconds == 0)
+    {
+      return 1;
+    }
+    std::cout << "  " << Options::fastMathName(mode) << ": " << seconds * 1e9
+	      << " ns per call" << std::endl;
+  }
+  return 0;
+}
@@ -1,6 +1,136 @@
 #include "kcomp.h"
+#include "aot.h"
+#include "error.h"
+#include "inliner.h"
+#include "options.h"
+#include "perf_map.h"
+#include "profile.h"
+#include "server.h"
+#include "time_report.h"
 
-void KCompiler::initialize_and_run()
+#include "llvm/Support/FileSystem.h"
+
+thread_local KCompiler * KCompiler::current_compiler = nullptr;
+
+KCompiler::KCompiler()
+  :
+  opt_level(Options::opt_level), fast_math(Options::fast_math),
+  whole_program(Options::batch || Options::emit_object || Options::emit_exe)
+{
+}
+
+void KCompiler::prompt()
+{
+  if (current().prompts)
+  {
+    err() << "ready> ";
+  }
+}
+
+void KCompiler::createJIT()
+{
+  makeCurrent();
+  if (!Options::cache_dir.empty())
+  {
+    object_cache = llvm::make_unique<KObjectCache>(
+      Options::cache_dir, uint64_t(Options::cache_size) << 20);
+  }
+  jit = llvm::make_unique<KJIT>(Options::lazy, Codegen::optimizeModule,
+				object_cache.get());
+  Codegen::configureBackend(jit->getTargetMachine());
+  if (object_cache)
+  {
+    object_cache->setConfiguration(Codegen::getConfigurationId());
+  }
+  Codegen::initializeModuleAndPassManager();
+}
+
+int KCompiler::run()
+{
+  makeCurrent();
+  bool aot = Options::emit_object || Options::emit_exe;
+  if (!Options::batch && !aot)
+  {
+    prompt();
+  }
+  parser.getNextToken();
+
+  if (!jit)
+  {
+    createJIT();
+  }
+  // by the process that runs the code (the perf map is named after it),
+  // for --server not the one that created the JIT
+  if (Options::perf)
+  {
+    // the jitdump needs an LLVM built with perf support, the map does not
+    static PerfMapListener perf_map;
+    jit->registerEventListener(perf_map);
+    if (auto * jitdump = llvm::JITEventListener::createPerfJITEventListener())
+    {
+      jit->registerEventListener(*jitdump);
+    }
+  }
+  if (Options::gdb)
+  {
+    jit->registerEventListener(
+      *llvm::JITEventListener::createGDBRegistrationListener());
+  }
+  if (aot)
+  {
+    if (!AOTCompiler::compile(parser.parseProgram()))
+    {
+      return 1;
+    }
+  }
+  else if (Options::batch)
+  {
+    parser.parseBatch();
+  }
+  else
+  {
+    parser.parse();
+  }
+
+  if (Options::print_stats)
+  {
+    parser.printStats();
+    auto & backend = jit->getBackendStats();
+    std::ostream & err = KCompiler::err();
+    err << "Machine code modules:     " << backend.modules << std::endl
+	<< "Machine code functions:   " << backend.functions << std::endl
+	<< "Machine code time:        " << backend.nanoseconds / 1e6 << " ms";
+    if (backend.functions)
+    {
+      err << ", " << backend.nanoseconds / 1e3 / backend.functions
+	  << " us per function";
+    }
+    err << std::endl
+	<< "Slowest module:           " << backend.max_nanoseconds / 1e6
+	<< " ms" << std::endl;
+    if (Inliner::enabled())
+    {
+      err << "Bodies imported to inline: " << inliner.getImported()
+	  << std::endl
+	  << "Definitions recompiled:   " << inliner.getRecompiled()
+	  << std::endl;
+    }
+    if (object_cache)
+    {
+      err << "Object cache hits:        " << object_cache->getHits()
+	  << std::endl
+	  << "Object cache misses:      " << object_cache->getMisses()
+	  << std::endl;
+    }
+  }
+  if (object_cache)
+  {
+    object_cache->prune();
+  }
+  return 0;
+}
+
+int KCompiler::initialize_and_run()
 {
   std::cout << "Kaleidoscope compiler version: " 
 			<< kcomp_VERSION_MAJOR << "." 
@@ -10,11 +140,53 @@ void KCompiler::initialize_and_run()
   llvm::InitializeNativeTargetAsmPrinter();
   llvm::InitializeNativeTargetAsmParser();
   llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+  Codegen::initializeBackendOptions();
+  if (Options::time_report != time_report_off)
+  {
+    TimeReport::enable(Options::time_passes);
+  }
+  if (!Options::server.empty())
+  {
+    return CompileServer::run(Options::server, Options::workers);
+  }
 
-  std::cerr << "ready> ";
-  Parser::getNextToken();
+  KCompiler compiler;
+  if (!Options::input_file.empty() && Options::input_file != "-")
+  {
+    if (!compiler.lexer.setInputFile(Options::input_file))
+    {
+      return 1;
+    }
+  }
+  int status = compiler.run();
+  if (status)
+  {
+    return status;
+  }
 
-  Codegen::jit = llvm::make_unique<llvm::orc::KaleidoscopeJIT>();
-  Codegen::initializeModuleAndPassManager();
-  Parser::parse();
+  if (Profiler::enabled())
+  {
+    Profiler::print(std::cerr);
+  }
+  if (TimeReport::enabled())
+  {
+    if (Options::time_report_file.empty())
+    {
+      TimeReport::print(llvm::errs());
+    }
+    else
+    {
+      std::error_code ec;
+      llvm::raw_fd_ostream out(Options::time_report_file, ec,
+			       llvm::sys::fs::F_Text);
+      if (ec)
+      {
+	Error::log("Could not open " + Options::time_report_file + ": " +
+		   ec.message());
+	return 1;
+      }
+      TimeReport::print(out);
+    }
+  }
+  return 0;
 }
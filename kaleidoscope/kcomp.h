@@ -1,14 +1,91 @@
 #ifndef _KCOMP_H_
 #define _KCOMP_H_
 
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
 #include "k_llvm.h"
 #include "kcomp_config.h"
 #include "codegen.h"
+#include "inliner.h"
+#include "lexer.h"
 #include "parser.h"
 
+// KCompiler - one compilation session: a lexer and a parser over its own
+// input, the prototypes of the functions defined so far, the definitions
+// the inliner retained, and a JIT with the settings :opt and :fastmath
+// change. The static interfaces (Lexer::instance(), Codegen,
+// PrototypeAST, ...) reach the compiler of the calling thread through
+// current(), so that independent compilers can run on threads of their own
+// in one process. The command line options, the symbol table, the profile
+// and the time report stay shared by the whole process (the --server
+// sessions each have a process of their own, see server.h).
 class KCompiler {
-public:
-  static void initialize_and_run();
+  static thread_local KCompiler * current_compiler;
+
+ public:
+  Lexer lexer;
+  Parser parser;
+  Inliner inliner;
+  // the definitions being compiled on other threads read the prototypes
+  // too (see compile_pool.h), they are only used under prototypes_mutex
+  llvm::DenseMap<symbol_t, std::shared_ptr<PrototypeAST>> prototypes;
+  unsigned prototype_stamp = 0; // registrations so far
+  std::mutex prototypes_mutex;
+  std::unique_ptr<KObjectCache> object_cache; // null without --cache-dir
+  std::unique_ptr<KJIT> jit;
+  OptLevel opt_level;
+  FastMath fast_math;
+  // true when the definitions are all compiled together (--batch, -c,
+  // --exe), so that calls can use the typed entry point of their callee.
+  // Otherwise the JIT reaches a definition through the stub of its double
+  // entry point, which stays valid whatever the return type of a later
+  // redefinition is (see KJIT)
+  bool whole_program;
+  // where the results and the diagnostics of the session go, and whether
+  // it prompts for each item
+  std::ostream * out_stream = &std::cout;
+  std::ostream * err_stream = &std::cerr;
+  bool prompts = true;
+
+  // a compiler set up from the command line options, reading stdin unless
+  // its lexer is given another input
+  KCompiler();
+
+  // the compiler of the calling thread
+  static KCompiler & current()
+  {
+    assert(current_compiler && "no compiler on this thread");
+    return *current_compiler;
+  }
+  // make this the compiler of the calling thread
+  void makeCurrent() { current_compiler = this; }
+
+  // the results and the diagnostics of the compiler of the calling thread,
+  // stdout and stderr outside of any
+  static std::ostream & out()
+  {
+    return current_compiler ? *current_compiler->out_stream : std::cout;
+  }
+  static std::ostream & err()
+  {
+    return current_compiler ? *current_compiler->err_stream : std::cerr;
+  }
+  // "ready> " before the next item, unless the compiler does not prompt
+  static void prompt();
+
+  // create the JIT, its target machine and the first module on the calling
+  // thread, done by run() unless done before
+  void createJIT();
+  // compile (and run) the whole input on the calling thread; returns the
+  // exit status
+  int run();
+
+  // the process: native target, the compiler of the command line and the
+  // reports at exit
+  static int initialize_and_run();
 };
 
 #endif
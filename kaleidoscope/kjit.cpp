@@ -0,0 +1,345 @@
+#include "kjit.h"
+#include "time_report.h"
+
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/IR/Mangler.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cassert>
+#include <set>
+
+KJIT::KJIT(bool lazy, optimize_function_t optimize, KObjectCache * cache)
+  :
+  lazy(lazy),
+  cache(cache),
+  optimize(optimize),
+  tm(createTargetMachine()),
+  dl(tm->createDataLayout()),
+  object_layer(es,
+	       [this](llvm::orc::VModuleKey k) {
+		 return object_layer_t::Resources{
+		   std::make_shared<llvm::SectionMemoryManager>(),
+		   resolvers[k]};
+	       },
+	       // loaded at its final addresses, before it is relocated; in
+	       // eager mode obj is over the buffer kept in objects
+	       [this](llvm::orc::VModuleKey, const llvm::object::ObjectFile & obj,
+		      const llvm::RuntimeDyld::LoadedObjectInfo & info) {
+		 for (auto * listener : listeners)
+		 {
+		   listener->NotifyObjectEmitted(obj, info);
+		 }
+	       }),
+  compile_layer(object_layer, TimedCompiler(*tm, backend_stats)),
+  optimize_layer(compile_layer,
+		 [this](std::unique_ptr<llvm::Module> m) {
+		   return this->optimize(std::move(m), *this->tm);
+		 }),
+  callback_manager(llvm::orc::createLocalCompileCallbackManager(
+		     tm->getTargetTriple(), es, 0)),
+  cod_layer(es, optimize_layer,
+	    [this](llvm::orc::VModuleKey k) { return resolvers[k]; },
+	    [this](llvm::orc::VModuleKey k,
+		   std::shared_ptr<llvm::orc::SymbolResolver> r) {
+	      resolvers[k] = std::move(r);
+	    },
+	    // one partition per function, so only what is called is compiled
+	    [](llvm::Function & f) { return std::set<llvm::Function *>({&f}); },
+	    *callback_manager,
+	    llvm::orc::createLocalIndirectStubsManagerBuilder(
+	      tm->getTargetTriple())),
+  stubs(llvm::orc::createLocalIndirectStubsManagerBuilder(
+	  tm->getTargetTriple())())
+{
+  llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+}
+
+std::unique_ptr<llvm::TargetMachine> KJIT::createTargetMachine()
+{
+  llvm::StringMap<bool> host_features;
+  std::vector<std::string> features;
+  if (llvm::sys::getHostCPUFeatures(host_features))
+  {
+    for (auto & feature : host_features)
+    {
+      features.push_back((feature.second ? "+" : "-") + feature.first().str());
+    }
+  }
+  return std::unique_ptr<llvm::TargetMachine>(
+    llvm::EngineBuilder()
+    .setMCPU(llvm::sys::getHostCPUName())
+    .setMAttrs(features)
+    .selectTarget());
+}
+
+llvm::orc::VModuleKey KJIT::addModule(std::unique_ptr<llvm::Module> m)
+{
+  // the optimizer and the backend run under this when compiling eagerly
+  TimeReport::Timer timer(phase_link);
+  if (!lazy)
+  {
+    // compiled here rather than by the compile layer, so that the object
+    // file can be kept
+    return addObject(compileModule(std::move(m), *tm));
+  }
+  auto k = es.allocateVModule();
+  resolvers[k] = createResolver();
+  std::vector<std::string> names = stubbedSymbols(*m);
+  // only stubs are emitted now, a function goes through the optimizer and
+  // the backend when its stub is first called
+  cantFail(cod_layer.addModule(k, std::move(m)));
+  bindStubs(k, names);
+  return k;
+}
+
+std::unique_ptr<llvm::MemoryBuffer> KJIT::compileModule(
+  std::unique_ptr<llvm::Module> m, llvm::TargetMachine & tm)
+{
+  assert(!lazy && "modules are compiled on demand");
+  if (cache)
+  {
+    cache->assignKey(*m);
+    if (auto obj = cache->load(*m))
+    {
+      return obj;
+    }
+  }
+  m = optimize(std::move(m), tm);
+  return TimedCompiler(tm, backend_stats, cache)(*m);
+}
+
+std::unique_ptr<llvm::MemoryBuffer> KJIT::TimedCompiler::operator()(
+  llvm::Module & m)
+{
+  TimeReport::Timer timer(phase_backend);
+  auto start = std::chrono::steady_clock::now();
+  auto obj = compiler(m);
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+
+  ++stats.modules;
+  for (auto & f : m)
+  {
+    if (!f.isDeclaration())
+    {
+      ++stats.functions;
+    }
+  }
+  stats.nanoseconds += ns;
+  uint64_t max = stats.max_nanoseconds;
+  while (ns > max && !stats.max_nanoseconds.compare_exchange_weak(max, ns))
+  {
+  }
+  return obj;
+}
+
+llvm::orc::VModuleKey KJIT::addObject(std::unique_ptr<llvm::MemoryBuffer> obj)
+{
+  TimeReport::Timer timer(phase_link);
+  assert(!lazy && "objects are not compiled on demand");
+  auto k = es.allocateVModule();
+  resolvers[k] = createResolver();
+  std::vector<std::string> names = stubbedSymbols(*obj);
+  // the layer frees the buffer it is given once the object is loaded
+  cantFail(object_layer.addObject(
+	     k, llvm::MemoryBuffer::getMemBuffer(obj->getMemBufferRef(),
+						 false)));
+  objects[k] = std::move(obj);
+  module_keys.push_back(k);
+  bindStubs(k, names);
+  return k;
+}
+
+bool KJIT::isStubbed(llvm::StringRef name)
+{
+  return !name.startswith("__");
+}
+
+std::vector<std::string> KJIT::stubbedSymbols(const llvm::Module & m)
+{
+  std::vector<std::string> names;
+  for (auto & f : m)
+  {
+    if (!f.isDeclaration() && f.hasExternalLinkage() && isStubbed(f.getName()))
+    {
+      names.push_back(mangle(f.getName()));
+    }
+  }
+  return names;
+}
+
+std::vector<std::string> KJIT::stubbedSymbols(const llvm::MemoryBuffer & obj)
+{
+  std::vector<std::string> names;
+  auto obj_file = 
+    llvm::object::ObjectFile::createObjectFile(obj.getMemBufferRef());
+  if (!obj_file)
+  {
+    // the object layer reports it
+    llvm::consumeError(obj_file.takeError());
+    return names;
+  }
+  for (const llvm::object::SymbolRef & sym : (*obj_file)->symbols())
+  {
+    uint32_t flags = sym.getFlags();
+    if ((flags & llvm::object::SymbolRef::SF_Undefined) ||
+	!(flags & llvm::object::SymbolRef::SF_Global))
+    {
+      continue;
+    }
+    auto type = sym.getType();
+    auto name = sym.getName();
+    if (type && name && *type == llvm::object::SymbolRef::ST_Function &&
+	isStubbed(*name))
+    {
+      names.push_back(name->str());
+    }
+    llvm::consumeError(type.takeError());
+    llvm::consumeError(name.takeError());
+  }
+  return names;
+}
+
+void KJIT::bindStubs(llvm::orc::VModuleKey k,
+		     const std::vector<std::string> & names)
+{
+  std::vector<llvm::orc::VModuleKey> replaced;
+  for (auto & name : names)
+  {
+    // in lazy mode the stub of the compile callback, the body is still only
+    // compiled when first called
+    llvm::JITSymbol body = lazy ? cod_layer.findSymbolIn(k, name, false) :
+      compile_layer.findSymbolIn(k, name, false);
+    llvm::JITTargetAddress addr = cantFail(body.getAddress());
+    if (stubs->findStub(name, false))
+    {
+      // a redefinition: a single pointer store retargets every caller
+      cantFail(stubs->updatePointer(name, addr));
+      llvm::orc::VModuleKey old = stub_targets[name];
+      if (--stubbed_bodies[old] == 0)
+      {
+	replaced.push_back(old);
+      }
+    }
+    else
+    {
+      cantFail(stubs->createStub(name, addr, llvm::JITSymbolFlags::Exported));
+    }
+    stub_targets[name] = k;
+    ++stubbed_bodies[k];
+  }
+  // nothing can reach the old bodies anymore
+  for (auto old : replaced)
+  {
+    stubbed_bodies.erase(old);
+    removeModule(old);
+  }
+}
+
+void KJIT::removeModule(llvm::orc::VModuleKey k)
+{
+  TimeReport::Timer timer(phase_link);
+  if (lazy)
+  {
+    cantFail(cod_layer.removeModule(k));
+  }
+  else
+  {
+    module_keys.erase(std::find(module_keys.begin(), module_keys.end(), k));
+    auto object = objects.find(k);
+    notifyFreeing(*object->second);
+    cantFail(compile_layer.removeModule(k));
+    objects.erase(object);
+  }
+  resolvers.erase(k);
+}
+
+void KJIT::notifyFreeing(const llvm::MemoryBuffer & obj)
+{
+  if (listeners.empty())
+  {
+    return;
+  }
+  auto obj_file =
+    llvm::object::ObjectFile::createObjectFile(obj.getMemBufferRef());
+  if (!obj_file)
+  {
+    // it could not have been loaded either
+    llvm::consumeError(obj_file.takeError());
+    return;
+  }
+  for (auto * listener : listeners)
+  {
+    listener->NotifyFreeingObject(**obj_file);
+  }
+}
+
+llvm::JITSymbol KJIT::findSymbol(const std::string name)
+{
+  return findMangledSymbol(mangle(name));
+}
+
+std::string KJIT::mangle(const std::string & name)
+{
+  std::string mangled_name;
+  {
+    llvm::raw_string_ostream mangled_name_stream(mangled_name);
+    llvm::Mangler::getNameWithPrefix(mangled_name_stream, name, dl);
+  }
+  return mangled_name;
+}
+
+llvm::JITSymbol KJIT::findMangledSymbol(const std::string & name)
+{
+  // callers of a definition are bound to its stub, not to its body
+  if (auto stub = stubs->findStub(name, true))
+  {
+    return stub;
+  }
+  if (lazy)
+  {
+    // the stubs of every function added so far, compiled or not
+    if (auto sym = cod_layer.findSymbol(name, false))
+    {
+      return sym;
+    }
+    else if (auto err = sym.takeError())
+    {
+      return std::move(err);
+    }
+  }
+  else
+  {
+    for (auto k : llvm::make_range(module_keys.rbegin(), module_keys.rend()))
+    {
+      if (auto sym = compile_layer.findSymbolIn(k, name, true))
+      {
+	return sym;
+      }
+      else if (auto err = sym.takeError())
+      {
+	return std::move(err);
+      }
+    }
+  }
+
+  // look up the symbol in the host process (the runtime in externs.cpp)
+  if (auto sym_addr = llvm::RTDyldMemoryManager::getSymbolAddressInProcess(name))
+  {
+    return llvm::JITSymbol(sym_addr, llvm::JITSymbolFlags::Exported);
+  }
+  return nullptr;
+}
+
+std::shared_ptr<llvm::orc::SymbolResolver> KJIT::createResolver()
+{
+  return llvm::orc::createLegacyLookupResolver(
+    es,
+    [this](const std::string & name) { return findMangledSymbol(name); },
+    [](llvm::Error err) { cantFail(std::move(err), "lookupFlags failed"); });
+}
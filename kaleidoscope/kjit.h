@@ -0,0 +1,164 @@
+#ifndef _KJIT_H_
+#define _KJIT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/Legacy.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include "object_cache.h"
+
+// KJIT - the JIT of the compiler, grown out of the KaleidoscopeJIT of the
+// LLVM examples. Modules are compiled to machine code either eagerly when
+// they are added, or, in lazy mode, split per function behind compile
+// callbacks: the optimizer and the backend only run on a function the first
+// time it is called. Eagerly compiled modules may go through an object cache.
+// Event listeners (perf, GDB) are told about every object file loaded and,
+// in eager mode, freed. In lazy mode the object layer frees the object
+// files of the partitions once loaded, so listeners that know an object by
+// its buffer (GDB) cannot be used.
+//
+// Other modules reach the functions a module defines through indirect stubs
+// (jumps through a pointer), so a redefinition is a new module plus a
+// pointer update, its callers need not be compiled again. The module of a
+// body no stub points to anymore is removed. Symbols starting with "__"
+// (top-level expressions) are not redefined and get no stubs.
+class KJIT {
+ public:
+  // optimizes a module for the target of the thread compiling it
+  typedef std::function<std::unique_ptr<llvm::Module>(
+    std::unique_ptr<llvm::Module>, llvm::TargetMachine &)>
+    optimize_function_t;
+
+  // time spent generating machine code (instruction selection, register
+  // allocation, emission), updated by all compiling threads
+  struct BackendStats {
+    std::atomic<uint64_t> modules{0};
+    std::atomic<uint64_t> functions{0};   // defined in those modules
+    std::atomic<uint64_t> nanoseconds{0};
+    std::atomic<uint64_t> max_nanoseconds{0}; // slowest module
+  };
+
+  // SimpleCompiler accounting for its time in a BackendStats
+  class TimedCompiler {
+    llvm::orc::SimpleCompiler compiler;
+    BackendStats & stats;
+
+   public:
+    TimedCompiler(llvm::TargetMachine & tm, BackendStats & stats,
+		  llvm::ObjectCache * cache = nullptr)
+      :
+    compiler(tm, cache), stats(stats) {}
+
+    std::unique_ptr<llvm::MemoryBuffer> operator()(llvm::Module & m);
+  };
+
+ private:
+  typedef llvm::orc::RTDyldObjectLinkingLayer object_layer_t;
+  typedef llvm::orc::IRCompileLayer<object_layer_t, TimedCompiler>
+    compile_layer_t;
+  // optimize for tm, the lazy mode compiles on the thread of the JIT
+  typedef std::function<std::unique_ptr<llvm::Module>(
+    std::unique_ptr<llvm::Module>)> transform_function_t;
+  typedef llvm::orc::IRTransformLayer<compile_layer_t, transform_function_t>
+    optimize_layer_t;
+  typedef llvm::orc::CompileOnDemandLayer<optimize_layer_t> cod_layer_t;
+
+  bool lazy;
+  KObjectCache * cache;
+  BackendStats backend_stats;
+  optimize_function_t optimize;
+  llvm::orc::ExecutionSession es;
+  std::map<llvm::orc::VModuleKey,
+	   std::shared_ptr<llvm::orc::SymbolResolver>> resolvers;
+  std::unique_ptr<llvm::TargetMachine> tm;
+  const llvm::DataLayout dl;
+  std::vector<llvm::JITEventListener *> listeners;
+  object_layer_t object_layer;
+  compile_layer_t compile_layer;
+  optimize_layer_t optimize_layer;
+  std::unique_ptr<llvm::orc::JITCompileCallbackManager> callback_manager;
+  cod_layer_t cod_layer;
+  std::unique_ptr<llvm::orc::IndirectStubsManager> stubs;
+  // module of the body each stub points to, and the number of stubs
+  // pointing into each of those modules
+  std::map<std::string, llvm::orc::VModuleKey> stub_targets;
+  std::map<llvm::orc::VModuleKey, unsigned> stubbed_bodies;
+  // eagerly compiled modules, searched newest first so that a redefinition
+  // shadows the previous one
+  std::vector<llvm::orc::VModuleKey> module_keys;
+  // their object files, kept until the module is removed rather than freed
+  // by the object layer once loaded: the listeners are told about the
+  // freeing of an object by the address of its buffer
+  std::map<llvm::orc::VModuleKey,
+	   std::unique_ptr<llvm::MemoryBuffer>> objects;
+
+ public:
+  // optimize runs on every module before it is compiled; in lazy mode on
+  // each function the first time it is called, with a cache only on the
+  // modules that miss it
+  KJIT(bool lazy, optimize_function_t optimize, KObjectCache * cache = nullptr);
+
+  // a target machine for the host CPU and all of its features (FMA, AVX,
+  // ...), the code is run where it is compiled
+  static std::unique_ptr<llvm::TargetMachine> createTargetMachine();
+
+  llvm::TargetMachine & getTargetMachine() { return *tm; }
+  // notify listener of the code loaded from now on, it must outlive the JIT
+  void registerEventListener(llvm::JITEventListener & listener)
+  {
+    listeners.push_back(&listener);
+  }
+  const BackendStats & getBackendStats() const { return backend_stats; }
+  bool isLazy() const { return lazy; }
+  // true if the functions of added modules must not be optimized yet, the
+  // optimize transform then runs the function passes too
+  bool optimizesModules() const { return lazy || cache; }
+
+  llvm::orc::VModuleKey addModule(std::unique_ptr<llvm::Module> m);
+  // the object file of a module, from the cache or built with tm (which may
+  // be the target machine of another thread), eager mode only
+  std::unique_ptr<llvm::MemoryBuffer> compileModule(
+    std::unique_ptr<llvm::Module> m, llvm::TargetMachine & tm);
+  // add code already compiled to an object file, eager mode only
+  llvm::orc::VModuleKey addObject(std::unique_ptr<llvm::MemoryBuffer> obj);
+  void removeModule(llvm::orc::VModuleKey k);
+  llvm::JITSymbol findSymbol(const std::string name);
+
+ private:
+  std::string mangle(const std::string & name);
+  // the mangled names of the functions of a module, or object, that get
+  // stubs
+  std::vector<std::string> stubbedSymbols(const llvm::Module & m);
+  static std::vector<std::string> stubbedSymbols(
+    const llvm::MemoryBuffer & obj);
+  static bool isStubbed(llvm::StringRef name);
+  // tell the listeners that the object file obj, kept in objects, is freed
+  void notifyFreeing(const llvm::MemoryBuffer & obj);
+  // point the stubs of names to their bodies in the module k, just added
+  void bindStubs(llvm::orc::VModuleKey k,
+		 const std::vector<std::string> & names);
+  // lookup of a mangled name from the host and from JIT-ed code
+  llvm::JITSymbol findMangledSymbol(const std::string & name);
+  std::shared_ptr<llvm::orc::SymbolResolver> createResolver();
+};
+
+#endif
@@ -1,12 +1,12 @@
 #include "lexer.h"
-
-Lexer * Lexer::p_instance = nullptr;
+#include "kcomp.h"
 
 Lexer * Lexer::instance()
 {
-  if (!p_instance)
-  {
-	p_instance = new Lexer();
-  }
-  return p_instance;
+  return &KCompiler::current().lexer;
+}
+
+void Lexer::emitError(const std::string & message)
+{
+  KCompiler::err() << message << std::endl;
 }
@@ -2,11 +2,18 @@
 #define _LEXER_H_
 
 #include <string>
+#include <memory>
 #include <cstdio>
 #include <cctype>
 #include <cerrno>
 #include <iostream>
 
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "symbol.h"
+
 // definition of various tokens
 enum Token {
   tok_eof = -1,
@@ -27,26 +34,81 @@ enum Token {
   tok_in = -10,
 
   tok_special_char = -11,
-  tok_invalid = -12
+  tok_invalid = -12,
+
+  // ':' command, up to the end of the line
+  tok_command = -13
 };
 
 class Parser;
 
 class Lexer {
  private: 
-  int lastChar = ' ';
   char lastSpecialChar = ' ';
-  std::string identifierStr;          // Filled in for tok_identifier
+  llvm::StringRef identifierStr;      // Filled in for tok_identifier
+  symbol_t identifierSym;             // Interned identifierStr
+  llvm::StringRef numStr;             // Spelling of the last tok_number
+  llvm::StringRef commandStr;         // Filled in for tok_command
   double numVal;                      // Filler in for tok_number
   enum Token lastToken = tok_invalid; // last processed token
 
-  static Lexer * p_instance; // singleton, only one instance of lexer allowed
+  // Input window. Tokens are handed out as views into [bufPtr, bufEnd), so
+  // identifierStr and numStr stay valid until the next call to getToken().
+  // Files are memory mapped (or read in one go) by llvm::MemoryBuffer and
+  // stay valid for the whole run; in interactive mode the window is the
+  // current line read from stdin, refilled whenever it is exhausted. Tokens
+  // never span a newline, so a refill only ever happens between tokens.
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  std::string line;
+  const char * bufPtr = nullptr;
+  const char * bufEnd = nullptr;
+  bool interactive = true;
 
   friend class Parser; // allow Parser to access the private members of the lexer
 
  public:
+  // the lexer of the compiler of the calling thread (see kcomp.h)
   static Lexer * instance();
 
+  // lex from a file, memory mapped when possible; returns false and leaves
+  // the input untouched when the file cannot be opened
+  bool setInputFile(const std::string & path)
+  {
+    auto file = llvm::MemoryBuffer::getFile(path, -1, false);
+    if (!file)
+    {
+      emitError("Cannot open " + path + ": " + file.getError().message());
+      return false;
+    }
+    setInputBuffer(std::move(*file));
+    return true;
+  }
+
+  // lex from an in-memory copy of source
+  void setInputString(llvm::StringRef source)
+  {
+    setInputBuffer(llvm::MemoryBuffer::getMemBufferCopy(source, "<string>"));
+  }
+
+  void setInputBuffer(std::unique_ptr<llvm::MemoryBuffer> input)
+  {
+    buffer = std::move(input);
+    bufPtr = buffer->getBufferStart();
+    bufEnd = buffer->getBufferEnd();
+    interactive = false;
+  }
+
+  // lex line by line from stdin (REPL mode), the default
+  void setInputStdin()
+  {
+    buffer.reset();
+    line.clear();
+    bufPtr = bufEnd = nullptr;
+    interactive = true;
+  }
+
+  bool isInteractive() const { return interactive; }
+
   void printLastToken()
   {
     std::cout << "Lexer::lastToken: ";
@@ -94,7 +156,7 @@ class Lexer {
 	}
     case tok_identifier:
 	{
-	  std::cout << "identifier: " << identifierStr << std::endl;
+	  std::cout << "identifier: " << identifierStr.str() << std::endl;
 	  break;
 	}
     case tok_number:
@@ -102,6 +164,11 @@ class Lexer {
 	  std::cout << "number: " << std::dec << numVal << std::endl;
 	  break;
 	}
+    case tok_command:
+	{
+	  std::cout << "command: " << commandStr.str() << std::endl;
+	  break;
+	}
     case tok_invalid:
 	{
 	  std::cout << "invalid" << std::endl;
@@ -120,106 +187,136 @@ class Lexer {
   int getToken()
   {
     // skip whitespaces
-    while (isspace(lastChar))
+    int c = peekChar();
+    while (isspace(c))
     {
-      lastChar = getchar();
+      ++bufPtr;
+      c = peekChar();
     }
     // reads in an identifier
-    if (isalpha(lastChar)) // identifier: [a-zA-Z][a-zA-Z0-9]*
+    if (isalpha(c)) // identifier: [a-zA-Z][a-zA-Z0-9]*
     {
-      identifierStr = lastChar;
+      const char * start = bufPtr;
 
       // read until a non alpha or number is found
-      while(isalnum((lastChar = getchar())))
+      while (++bufPtr != bufEnd && isalnum(static_cast<unsigned char>(*bufPtr)))
       {
-	identifierStr += lastChar;
       }
-      if (identifierStr == "def")
+      identifierStr = llvm::StringRef(start, bufPtr - start);
+      identifierSym = Symbols::intern(identifierStr);
+      switch (identifierSym)
       {
+      case sym_def:
 	lastToken = tok_def;
-	return tok_def;
-      }
-      if (identifierStr == "if")
-      {
+	break;
+      case sym_if:
 	lastToken = tok_if;
-	return tok_if;
-      }
-      if (identifierStr == "then")
-      {
+	break;
+      case sym_then:
 	lastToken = tok_then;
-	return tok_then;
-      }
-      if (identifierStr == "else")
-      {
+	break;
+      case sym_else:
 	lastToken = tok_else;
-	return tok_else;
-      }
-      if (identifierStr == "for")
-      {
+	break;
+      case sym_for:
 	lastToken = tok_for;
-	return tok_for;
-      }
-      if (identifierStr == "in")
-      {
+	break;
+      case sym_in:
 	lastToken = tok_in;
-	return tok_in;
-      }
-      if (identifierStr == "extern")
-      {
+	break;
+      case sym_extern:
 	lastToken = tok_extern;
-	return tok_extern;
+	break;
+      default:
+	// not a keywork, must be an identifier
+	lastToken = tok_identifier;
       }
-      // not a keywork, must be an identifier
-      lastToken = tok_identifier;
-      return tok_identifier;
+      return lastToken;
     }
     // reads in a number
-    if (isdigit(lastChar))  // numbers: [0-9.]+
+    if (isdigit(c))  // numbers: [0-9.]+
     {
-      std::string numStr;
-      do {
-	numStr += lastChar;
-	lastChar = getchar();
-      } while (isdigit(lastChar) || lastChar == '.');
-      
-      numVal = strtod(numStr.c_str(), 0);
+      const char * start = bufPtr;
+      while (++bufPtr != bufEnd && 
+	     (isdigit(static_cast<unsigned char>(*bufPtr)) || *bufPtr == '.'))
+      {
+      }
+      numStr = llvm::StringRef(start, bufPtr - start);
+
+      // strtod needs a terminated string and must not run past the token
+      // (e.g. into "1e5"), so convert a small local copy of the spelling
+      llvm::SmallString<32> spelling(numStr);
+      errno = 0;
+      numVal = strtod(spelling.c_str(), 0);
       if (errno != 0 && numVal == 0.0)
       {
-	emitError("Invalid number: "+numStr);
+	emitError("Invalid number: "+numStr.str());
+	lastToken = tok_invalid;
+	return tok_invalid;
       }
       lastToken = tok_number;
       return tok_number;
     }
-    if (lastChar == '#')
+    if (c == ':')
     {
-      do {
-	lastChar = getchar();
-      } while(lastChar != EOF && lastChar != '\n' && lastChar != '\r');
-      // anything but EOF, read in the next token
-      if (lastChar != EOF)
+      // compiler commands (e.g. ":opt 2") take the rest of the line
+      const char * start = ++bufPtr;
+      while (bufPtr != bufEnd && *bufPtr != '\n' && *bufPtr != '\r')
       {
-	return getToken();
+	++bufPtr;
       }
+      commandStr = llvm::StringRef(start, bufPtr - start).trim();
+      lastToken = tok_command;
+      return tok_command;
+    }
+    if (c == '#')
+    {
+      // comments run until the end of the line
+      while (bufPtr != bufEnd && *bufPtr != '\n' && *bufPtr != '\r')
+      {
+	++bufPtr;
+      }
+      return getToken();
     }
     // check for EOF
-    if (lastChar == EOF)
+    if (c == EOF)
     {
       lastToken = tok_eof;
       return tok_eof;
     }                    
-    lastSpecialChar = lastChar;
-    lastChar = getchar();
+    lastSpecialChar = c;
+    ++bufPtr;
     lastToken = tok_special_char;
     return tok_special_char; 
   }
   int getLastSpecialChar() const { return lastSpecialChar; }
 
  private:
-  void emitError(std::string message)
+  // returns the current character without consuming it, or EOF
+  int peekChar()
+  {
+    if (bufPtr == bufEnd && !refill())
+    {
+      return EOF;
+    }
+    return static_cast<unsigned char>(*bufPtr);
+  }
+
+  // fetch the next line from stdin; files are consumed in one buffer
+  bool refill()
   {
-    std::cerr << message << std::endl;
-    exit(-1);
+    if (!interactive || !std::getline(std::cin, line))
+    {
+      return false;
+    }
+    line += '\n';
+    bufPtr = line.data();
+    bufEnd = bufPtr + line.size();
+    return true;
   }
+
+  // report on the diagnostics of the compiler
+  void emitError(const std::string & message);
 };
 
 #endif
@@ -0,0 +1,142 @@
+#include "object_cache.h"
+
+#include <algorithm>
+#include <utime.h>
+#include <vector>
+
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+static const char * const key_prefix = "llvmcache-";
+
+KObjectCache::KObjectCache(std::string dir, uint64_t max_size)
+  :
+  dir(std::move(dir)), max_size(max_size)
+{
+  llvm::sys::fs::create_directories(this->dir);
+}
+
+std::string KObjectCache::getPath(llvm::StringRef key) const
+{
+  llvm::SmallString<128> path(dir);
+  llvm::sys::path::append(path, key);
+  return path.str().str();
+}
+
+void KObjectCache::assignKey(llvm::Module & m) const
+{
+  llvm::SmallVector<char, 0> bitcode;
+  {
+    llvm::raw_svector_ostream bitcode_stream(bitcode);
+    llvm::WriteBitcodeToFile(m, bitcode_stream);
+  }
+
+  llvm::MD5 hash;
+  hash.update(llvm::StringRef(bitcode.data(), bitcode.size()));
+  hash.update(configuration);
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  llvm::SmallString<32> digest;
+  llvm::MD5::stringifyResult(result, digest);
+
+  m.setModuleIdentifier(key_prefix + digest.str().str());
+}
+
+std::unique_ptr<llvm::MemoryBuffer> KObjectCache::load(const llvm::Module & m)
+{
+  std::string path = getPath(m.getModuleIdentifier());
+  auto obj = llvm::MemoryBuffer::getFile(path, -1, false);
+  if (!obj)
+  {
+    ++misses;
+    return nullptr;
+  }
+  ++hits;
+  // prune() goes by the modification time, the access time is not kept
+  // on every file system (noatime)
+  utime(path.c_str(), nullptr);
+  return std::move(*obj);
+}
+
+void KObjectCache::notifyObjectCompiled(const llvm::Module * m,
+					llvm::MemoryBufferRef obj)
+{
+  llvm::StringRef key = m->getModuleIdentifier();
+  if (!key.startswith(key_prefix))
+  {
+    return;
+  }
+
+  // write to a temporary file first, so other threads and processes only
+  // ever see complete entries; without the key prefix, so that a prune
+  // running meanwhile does not remove it
+  int fd;
+  llvm::SmallString<128> tmp_path;
+  if (llvm::sys::fs::createUniqueFile(getPath("tmp-%%%%%%%%"), fd, tmp_path))
+  {
+    return;
+  }
+  {
+    llvm::raw_fd_ostream out(fd, true);
+    out << obj.getBuffer();
+  }
+  if (llvm::sys::fs::rename(tmp_path, getPath(key)))
+  {
+    llvm::sys::fs::remove(tmp_path);
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer> KObjectCache::getObject(const llvm::Module * m)
+{
+  // KJIT looks the module up with load() before optimizing it, by the time
+  // it is compiled it is known to be missing
+  return nullptr;
+}
+
+void KObjectCache::prune()
+{
+  if (max_size == 0)
+  {
+    return;
+  }
+  // the size limit only, no expiration: llvm::pruneCache would remove the
+  // largest files first, whatever their use
+  struct Entry {
+    llvm::sys::TimePoint<> used;
+    uint64_t size;
+    std::string path;
+  };
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  std::error_code ec;
+  for (llvm::sys::fs::directory_iterator it(dir, ec), end;
+       !ec && it != end; it.increment(ec))
+  {
+    llvm::sys::fs::file_status status;
+    // the temporary files of the writers are not entries yet
+    if (!llvm::sys::path::filename(it->path()).startswith(key_prefix) ||
+	llvm::sys::fs::status(it->path(), status))
+    {
+      continue;
+    }
+    entries.push_back({status.getLastModificationTime(), status.getSize(),
+		       it->path()});
+    total += status.getSize();
+  }
+  std::sort(entries.begin(), entries.end(),
+	    [](const Entry & a, const Entry & b) { return a.used < b.used; });
+  for (auto & entry : entries)
+  {
+    if (total <= max_size)
+    {
+      break;
+    }
+    if (!llvm::sys::fs::remove(entry.path))
+    {
+      total -= entry.size;
+    }
+  }
+}
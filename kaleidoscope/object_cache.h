@@ -0,0 +1,55 @@
+#ifndef _OBJECT_CACHE_H_
+#define _OBJECT_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+// On-disk cache of the object files compiled by the JIT. A module is keyed
+// by a hash of its IR before optimization together with the configuration
+// of the compiler (pass pipeline, target), so a hit skips both the optimizer
+// and the backend. Entries are files named llvmcache-<key> in the cache
+// directory, which prune() trims to the size limit, least recently used
+// first (written or loaded, see load()); they never expire otherwise.
+class KObjectCache : public llvm::ObjectCache {
+ private:
+  std::string dir;
+  uint64_t max_size;        // bytes, 0 for no limit
+  std::string configuration;
+  std::atomic<unsigned> hits{0};
+  std::atomic<unsigned> misses{0};
+
+  std::string getPath(llvm::StringRef key) const;
+
+ public:
+  KObjectCache(std::string dir, uint64_t max_size);
+
+  // anything that changes the code generated for the same IR (pass pipeline,
+  // target triple and CPU) must be part of the configuration
+  void setConfiguration(std::string c) { configuration = std::move(c); }
+
+  // hash the module and record the key as its identifier, must be done
+  // before the module is optimized
+  void assignKey(llvm::Module & m) const;
+  // the object cached for a module with a key, counted as a hit or a miss;
+  // a hit marks the entry as used
+  std::unique_ptr<llvm::MemoryBuffer> load(const llvm::Module & m);
+
+  // llvm::ObjectCache, used by the compiler of the JIT
+  void notifyObjectCompiled(const llvm::Module * m,
+			    llvm::MemoryBufferRef obj) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module * m) override;
+
+  // remove the least recently used entries over the size limit, if any
+  void prune();
+
+  unsigned getHits() const { return hits; }
+  unsigned getMisses() const { return misses; }
+};
+
+#endif
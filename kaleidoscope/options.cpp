@@ -0,0 +1,504 @@
+#include "options.h"
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+#include "llvm/ADT/StringRef.h"
+
+std::string Options::input_file;
+bool Options::print_stats = false;
+bool Options::flat_ast = false;
+bool Options::batch = false;
+unsigned Options::jobs = 1;
+bool Options::emit_object = false;
+bool Options::emit_exe = false;
+std::string Options::output_file;
+bool Options::lazy = false;
+std::string Options::cache_dir;
+unsigned Options::cache_size = 0;
+OptLevel Options::opt_level = opt_fast_compile;
+unsigned Options::backend_opt = 2;
+ISel Options::isel = isel_default;
+FastMath Options::fast_math = fm_off;
+ProfileMode Options::profile = profile_off;
+bool Options::perf = false;
+bool Options::gdb = false;
+TimeReportFormat Options::time_report = time_report_off;
+bool Options::time_passes = false;
+std::string Options::time_report_file;
+bool Options::fold = true;
+bool Options::infer_types = true;
+unsigned Options::interp_threshold = 64;
+unsigned Options::inline_threshold = 40;
+std::string Options::server;
+unsigned Options::workers = 0;
+
+// the value of a numeric option, reported when it is not a number
+static bool parseUnsigned(const std::string & option, const char * text,
+			  unsigned & value)
+{
+  if (llvm::StringRef(text).getAsInteger(10, value))
+  {
+    std::cerr << option << " needs a number, not '" << text << "'"
+	      << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Options::parse(int argc, char ** argv)
+{
+  // --isel overrides the selector of --backend wherever it is
+  bool isel_given = false;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help")
+    {
+      return false;
+    }
+    if (arg == "--stats")
+    {
+      print_stats = true;
+      continue;
+    }
+    if (arg == "--flat")
+    {
+      flat_ast = true;
+      continue;
+    }
+    if (arg == "--batch")
+    {
+      batch = true;
+      continue;
+    }
+    if ((arg == "-j" || arg == "--jobs") && i + 1 < argc)
+    {
+      if (!parseUnsigned(arg, argv[++i], jobs))
+      {
+	return false;
+      }
+      continue;
+    }
+    if (arg == "-c")
+    {
+      emit_object = true;
+      continue;
+    }
+    if (arg == "--exe")
+    {
+      emit_exe = true;
+      continue;
+    }
+    if (arg == "-o" && i + 1 < argc)
+    {
+      output_file = argv[++i];
+      continue;
+    }
+    if (arg == "--lazy")
+    {
+      lazy = true;
+      continue;
+    }
+    if (arg == "--cache-dir" && i + 1 < argc)
+    {
+      cache_dir = argv[++i];
+      continue;
+    }
+    if (arg == "--cache-size" && i + 1 < argc)
+    {
+      if (!parseUnsigned(arg, argv[++i], cache_size))
+      {
+	return false;
+      }
+      continue;
+    }
+    if (arg.compare(0, 2, "-O") == 0 && parseOptLevel(arg.substr(2), opt_level))
+    {
+      continue;
+    }
+    if (arg == "--backend" && i + 1 < argc)
+    {
+      // presets: fast is the low latency configuration for interactive use
+      std::string preset = argv[++i];
+      if (preset == "fast")
+      {
+	backend_opt = 0;
+	isel = isel_given ? isel : isel_fast;
+      }
+      else if (preset == "default" || preset == "aggressive")
+      {
+	backend_opt = preset == "default" ? 2 : 3;
+	isel = isel_given ? isel : isel_default;
+      }
+      else
+      {
+	std::cerr << "Unknown backend configuration: " << preset << std::endl;
+	return false;
+      }
+      continue;
+    }
+    if (arg == "--isel" && i + 1 < argc)
+    {
+      std::string selector = argv[++i];
+      if (selector == "default")
+      {
+	isel = isel_default;
+      }
+      else if (selector == "fast")
+      {
+	isel = isel_fast;
+      }
+      else if (selector == "global")
+      {
+	isel = isel_global;
+      }
+      else
+      {
+	std::cerr << "Unknown instruction selector: " << selector << std::endl;
+	return false;
+      }
+      isel_given = true;
+      continue;
+    }
+    if (arg == "--fast-math")
+    {
+      fast_math = fm_fast;
+      continue;
+    }
+    if (arg == "--fp-contract")
+    {
+      fast_math = fm_contract;
+      continue;
+    }
+    if (arg == "--profile" && i + 1 < argc)
+    {
+      std::string mode = argv[++i];
+      if (mode == "calls" || mode == "time")
+      {
+	profile = mode == "calls" ? profile_calls : profile_time;
+      }
+      else
+      {
+	std::cerr << "Unknown profile mode: " << mode << std::endl;
+	return false;
+      }
+      continue;
+    }
+    if (arg == "--time-report" || arg == "--time-report=text")
+    {
+      time_report = time_report_text;
+      continue;
+    }
+    if (arg == "--time-report=json")
+    {
+      time_report = time_report_json;
+      continue;
+    }
+    if (arg == "--time-passes")
+    {
+      time_passes = true;
+      continue;
+    }
+    if (arg == "--time-report-file" && i + 1 < argc)
+    {
+      time_report_file = argv[++i];
+      continue;
+    }
+    if (arg == "--perf")
+    {
+      perf = true;
+      continue;
+    }
+    if (arg == "--gdb")
+    {
+      gdb = true;
+      continue;
+    }
+    if (arg == "--no-fold")
+    {
+      fold = false;
+      continue;
+    }
+    if (arg == "--no-types")
+    {
+      infer_types = false;
+      continue;
+    }
+    if (arg == "--interp-threshold" && i + 1 < argc)
+    {
+      if (!parseUnsigned(arg, argv[++i], interp_threshold))
+      {
+	return false;
+      }
+      continue;
+    }
+    if (arg == "--inline-threshold" && i + 1 < argc)
+    {
+      if (!parseUnsigned(arg, argv[++i], inline_threshold))
+      {
+	return false;
+      }
+      continue;
+    }
+    if (arg == "--server" && i + 1 < argc)
+    {
+      server = argv[++i];
+      continue;
+    }
+    if (arg == "--workers" && i + 1 < argc)
+    {
+      if (!parseUnsigned(arg, argv[++i], workers))
+      {
+	return false;
+      }
+      continue;
+    }
+    if (arg[0] == '-' && arg != "-")
+    {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return false;
+    }
+    if (!input_file.empty())
+    {
+      std::cerr << "Only one input file is supported" << std::endl;
+      return false;
+    }
+    input_file = arg;
+  }
+  if (batch && (input_file.empty() || input_file == "-"))
+  {
+    std::cerr << "--batch needs an input file" << std::endl;
+    return false;
+  }
+  if (emit_object || emit_exe)
+  {
+    if (input_file.empty() || input_file == "-")
+    {
+      std::cerr << "-c and --exe need an input file" << std::endl;
+      return false;
+    }
+    if (batch || lazy || jobs > 1)
+    {
+      std::cerr << "-c and --exe cannot be combined with --batch, --lazy or -j"
+		<< std::endl;
+      return false;
+    }
+    if (profile != profile_off || perf || gdb)
+    {
+      // the profile and the listeners live in the compiler process
+      std::cerr << "-c and --exe cannot be combined with --profile, --perf"
+		<< " or --gdb" << std::endl;
+      return false;
+    }
+    if (output_file.empty())
+    {
+      // file.k -> file.o for objects, a.out for executables
+      std::string stem = input_file;
+      if (stem.size() > 2 && stem.compare(stem.size() - 2, 2, ".k") == 0)
+      {
+	stem.resize(stem.size() - 2);
+      }
+      output_file = emit_exe ? "a.out" : stem + ".o";
+    }
+  }
+  if (jobs > 1 && (batch || lazy))
+  {
+    std::cerr << "-j cannot be combined with --batch or --lazy" << std::endl;
+    return false;
+  }
+  if (time_passes || !time_report_file.empty())
+  {
+    if (time_report == time_report_off)
+    {
+      time_report = time_report_text;
+    }
+    if (time_passes && jobs > 1)
+    {
+      // the pass timers are shared by every pass manager
+      std::cerr << "--time-passes cannot be combined with -j" << std::endl;
+      return false;
+    }
+  }
+  if (lazy && !cache_dir.empty())
+  {
+    std::cerr << "--cache-dir cannot be combined with --lazy" << std::endl;
+    return false;
+  }
+  if (lazy && gdb)
+  {
+    // GDB knows an object by its buffer, freed after loading in lazy mode
+    std::cerr << "--gdb cannot be combined with --lazy" << std::endl;
+    return false;
+  }
+  if (!server.empty())
+  {
+    // the sessions come from the clients and the server never exits
+    if (!input_file.empty() || batch || emit_object || emit_exe ||
+	time_report != time_report_off)
+    {
+      std::cerr << "--server cannot be combined with an input file, --batch,"
+		<< " -c, --exe or --time-report" << std::endl;
+      return false;
+    }
+    if (workers == 0)
+    {
+      workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+  }
+  else if (workers)
+  {
+    std::cerr << "--workers needs --server" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void Options::usage(const char * program)
+{
+  std::cerr << "usage: " << program << " [options] [file.k]" << std::endl
+	    << "  without a file (or with '-') read a REPL session from stdin"
+	    << std::endl
+	    << "  --stats     print AST allocation statistics at exit" 
+	    << std::endl
+	    << "  --flat      generate IR through the flat (index based) AST,"
+	    << " lowered from the" << std::endl
+	    << "              parsed tree" << std::endl
+	    << "  --batch     compile the whole file into one module with"
+	    << " interprocedural" << std::endl
+	    << "              optimization, then run its top-level expressions"
+	    << std::endl
+	    << "  -c          compile the whole file to an object file"
+	    << std::endl
+	    << "  --exe       compile the whole file to an executable that runs"
+	    << " its" << std::endl
+	    << "              top-level expressions" << std::endl
+	    << "  -o FILE     output of -c (default file.o) and --exe"
+	    << " (default a.out)" << std::endl
+	    << "  -j N        compile definitions on N threads" << std::endl
+	    << "  --lazy      optimize and compile a function only when it is"
+	    << " first called" << std::endl
+	    << "  --cache-dir DIR" << std::endl
+	    << "              reuse the object files of unchanged modules across"
+	    << " runs" << std::endl
+	    << "  --cache-size MB" << std::endl
+	    << "              trim the cache to MB megabytes at exit"
+	    << " (default 0 = no limit)" << std::endl
+	    << "  -O0 .. -O3  optimization level of the generated code"
+	    << std::endl
+	    << "  -Ofast-compile" << std::endl
+	    << "              a few cheap function passes only (default)"
+	    << std::endl
+	    << "  --backend fast|default|aggressive" << std::endl
+	    << "              machine code generation: fast is FastISel, the fast"
+	    << " register" << std::endl
+	    << "              allocator and no backend optimization (default:"
+	    << " default)" << std::endl
+	    << "  --isel default|fast|global" << std::endl
+	    << "              instruction selector, overrides the one of --backend" << std::endl
+	    << "  --fast-math reassociate, contract and assume finite, non-NaN"
+	    << " values in" << std::endl
+	    << "              floating point arithmetic" << std::endl
+	    << "  --fp-contract" << std::endl
+	    << "              only fuse multiplies and adds into FMAs" << std::endl
+	    << "  --profile calls|time" << std::endl
+	    << "              count the calls of every function, and with time"
+	    << " the cycles" << std::endl
+	    << "              spent in it, printed at exit and by :profile"
+	    << std::endl
+	    << "  --perf      write /tmp/perf-<pid>.map (and a jitdump when LLVM"
+	    << " has perf" << std::endl
+	    << "              support) so that perf report names the JIT-ed"
+	    << " functions" << std::endl
+	    << "  --gdb       register the JIT-ed code with GDB, for backtraces"
+	    << " and" << std::endl
+	    << "              breakpoints in Kaleidoscope functions" << std::endl
+	    << "  --time-report[=text|json]" << std::endl
+	    << "              print the wall and CPU time of each compiler phase"
+	    << " (lex, parse," << std::endl
+	    << "              analyze, codegen, optimize, backend, link, execute)"
+	    << " at exit" << std::endl
+	    << "  --time-passes" << std::endl
+	    << "              add the time of every LLVM pass to the report"
+	    << std::endl
+	    << "  --time-report-file FILE" << std::endl
+	    << "              write the report to FILE instead of stderr"
+	    << std::endl
+	    << "  --no-fold   do not fold constants on the AST before codegen"
+	    << std::endl
+	    << "  --no-types  compute every value as a double, without integer"
+	    << " and bool" << std::endl
+	    << "              types inferred" << std::endl
+	    << "  --interp-threshold N"  << std::endl
+	    << "              interpret loop-free top-level expressions of up to"
+	    << " N nodes" << std::endl
+	    << "              instead of compiling them (default 64, 0 = never)"
+	    << std::endl
+	    << "  --inline-threshold N" << std::endl
+	    << "              inline definitions of up to N instructions into"
+	    << " the functions" << std::endl
+	    << "              and expressions entered after them, recompiling"
+	    << " those when" << std::endl
+	    << "              they are redefined (default 40, 0 = never)"
+	    << std::endl
+	    << "  --server PATH" << std::endl
+	    << "              serve REPL sessions on the Unix socket PATH: each"
+	    << " connection" << std::endl
+	    << "              sends its input, shuts down writing and reads back"
+	    << " the output;" << std::endl
+	    << "              each session runs in a process of its own"
+	    << std::endl
+	    << "  --workers N sessions compiled at once by --server (default:"
+	    << " one per core)" << std::endl;
+}
+
+bool Options::parseOptLevel(const std::string & name, OptLevel & level)
+{
+  if (name == "fast-compile")
+  {
+    level = opt_fast_compile;
+    return true;
+  }
+  if (name.size() == 1 && name[0] >= '0' && name[0] <= '3')
+  {
+    level = OptLevel(name[0] - '0');
+    return true;
+  }
+  return false;
+}
+
+std::string Options::optLevelName(OptLevel level)
+{
+  if (level == opt_fast_compile)
+  {
+    return "-Ofast-compile";
+  }
+  return "-O" + std::to_string(level);
+}
+
+bool Options::parseFastMath(const std::string & name, FastMath & mode)
+{
+  if (name == "off")
+  {
+    mode = fm_off;
+  }
+  else if (name == "contract")
+  {
+    mode = fm_contract;
+  }
+  else if (name == "on")
+  {
+    mode = fm_fast;
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+std::string Options::fastMathName(FastMath mode)
+{
+  static const char * const names[] = { "off", "contract", "on" };
+  return names[mode];
+}
@@ -0,0 +1,90 @@
+#ifndef _OPTIONS_H_
+#define _OPTIONS_H_
+
+#include <string>
+
+// optimization levels, -O0 to -O3 and -Ofast-compile (the default), which
+// only runs a few cheap function passes
+enum OptLevel : unsigned {
+  opt_none = 0,
+  opt_less,
+  opt_default,
+  opt_aggressive,
+  opt_fast_compile
+};
+
+// instruction selector of the backend, by default SelectionDAG (or FastISel
+// when the target prefers it without optimization)
+enum ISel : unsigned {
+  isel_default = 0,
+  isel_fast,
+  isel_global
+};
+
+// fast-math flags of the generated floating point arithmetic
+enum FastMath : unsigned {
+  fm_off = 0,
+  fm_contract,  // fuse multiplies and adds into FMAs
+  fm_fast       // every fast-math flag: also reassociate and assume no NaNs,
+                // infinities or signed zeros
+};
+
+// instrumentation of the generated functions (see profile.h)
+enum ProfileMode : unsigned {
+  profile_off = 0,
+  profile_calls,  // count calls
+  profile_time    // count calls and cycles
+};
+
+// format of the compile time report printed at exit (see time_report.h)
+enum TimeReportFormat : unsigned {
+  time_report_off = 0,
+  time_report_text,
+  time_report_json
+};
+
+// Command line options of the compiler
+class Options {
+ public:
+  static std::string input_file; // source file to compile, empty for the REPL
+  static bool print_stats;       // --stats: print allocation statistics at exit
+  static bool flat_ast;          // --flat: codegen through the flat AST walker
+  static bool batch;             // --batch: whole-program compilation of a file
+  static unsigned jobs;          // -j N: threads compiling definitions
+  static bool emit_object;       // -c: compile the file to an object file
+  static bool emit_exe;          // --exe: compile the file to an executable
+  static std::string output_file; // -o: output of -c and --exe
+  static bool lazy;              // --lazy: compile functions on first call
+  static std::string cache_dir;  // --cache-dir: object cache, empty for none
+  static unsigned cache_size;    // --cache-size: cache limit in MB, 0 = none
+  static OptLevel opt_level;     // -O<level>
+  static unsigned backend_opt;   // --backend: CodeGenOpt level, 0-3
+  static ISel isel;              // --isel: instruction selector
+  static FastMath fast_math;     // --fast-math, --fp-contract
+  static ProfileMode profile;    // --profile calls|time
+  static bool perf;              // --perf: perf map and jitdump of the code
+  static bool gdb;               // --gdb: register the code with GDB
+  static TimeReportFormat time_report; // --time-report[=json]
+  static bool time_passes;       // --time-passes: per-pass timings too
+  static std::string time_report_file; // --time-report-file, default stderr
+  static bool fold;              // constant folding on the AST, --no-fold
+  static bool infer_types;       // integer and bool values, --no-types
+  static unsigned interp_threshold; // --interp-threshold: largest top-level
+                                    // expression interpreted instead of JIT-ed
+  static unsigned inline_threshold; // --inline-threshold: largest definition
+                                    // inlined into later modules
+  static std::string server;     // --server: socket of the compile server
+  static unsigned workers;       // --workers N: sessions served at once
+
+  // parse the command line, returns false on invalid usage
+  static bool parse(int argc, char ** argv);
+  static void usage(const char * program);
+  // level from its name, "0" to "3" or "fast-compile"
+  static bool parseOptLevel(const std::string & name, OptLevel & level);
+  static std::string optLevelName(OptLevel level);
+  // mode from its name, "off", "contract" or "on"
+  static bool parseFastMath(const std::string & name, FastMath & mode);
+  static std::string fastMathName(FastMath mode);
+};
+
+#endif
@@ -1,12 +1,19 @@
 #include "parser.h"
 #include "codegen.h"
+#include "compile_pool.h"
 #include "error.h"
+#include "inliner.h"
+#include "interp.h"
+#include "kcomp.h"
+#include "options.h"
+#include "profile.h"
+#include "time_report.h"
+#include "llvm/Support/raw_os_ostream.h"
 #include <iostream>
 #include <cctype>
 #include <string>
 
 // Parser for Kaleidoscope
-int Parser::cur_tok;
 binop_precedence_t Parser::binop_precedence;
 BinopPrecedenceConstructor Parser::binop_precedence_constructor;
 
@@ -20,8 +27,12 @@ BinopPrecedenceConstructor::BinopPrecedenceConstructor()
   Parser::binop_precedence['*'] = 40;  // highest priority
 }
 
+Parser::Parser() = default;
+Parser::~Parser() = default;
+
 int Parser::getNextToken() 
 { 
+  TimeReport::Timer timer(phase_lex);
   cur_tok = Lexer::instance()->getToken(); 
   //Lexer::instance()->printToken();
   if (cur_tok == tok_special_char)
@@ -31,14 +42,14 @@ int Parser::getNextToken()
   return cur_tok;
 }
   
-std::unique_ptr<ExprAST> Parser::parseNumberExpr()
+ExprAST * Parser::parseNumberExpr()
 {
-  auto result = llvm::make_unique<NumberExprAST>(Lexer::instance()->numVal);
+  auto result = arena.make<NumberExprAST>(Lexer::instance()->numVal);
   getNextToken(); // consume the number
-  return std::move(result);
+  return result;
 }
 
-std::unique_ptr<ExprAST> Parser::parseIfExpr()
+ExprAST * Parser::parseIfExpr()
 {
   getNextToken(); // eat the 'if'
   
@@ -71,12 +82,10 @@ std::unique_ptr<ExprAST> Parser::parseIfExpr()
     return nullptr;
   }
 
-  return llvm::make_unique<IfExprAST>(std::move(cond_expr), 
-                                      std::move(then_expr), 
-                                      std::move(else_expr));
+  return arena.make<IfExprAST>(cond_expr, then_expr, else_expr);
 }
 
-std::unique_ptr<ExprAST> Parser::parseForExpr()
+ExprAST * Parser::parseForExpr()
 {
   getNextToken(); // eat the 'for'
 
@@ -85,7 +94,7 @@ std::unique_ptr<ExprAST> Parser::parseForExpr()
     return Error::log("expected identifier after 'for'");
   }
 
-  std::string id_name = Lexer::instance()->identifierStr;
+  symbol_t id_name = Lexer::instance()->identifierSym;
   getNextToken(); // eat identifier
 
   if (cur_tok != '=')
@@ -111,7 +120,7 @@ std::unique_ptr<ExprAST> Parser::parseForExpr()
     return nullptr;
   }
   
-  std::unique_ptr<ExprAST> step;
+  ExprAST * step = nullptr;
   if (cur_tok == ',')
   {
     getNextToken();
@@ -134,12 +143,10 @@ std::unique_ptr<ExprAST> Parser::parseForExpr()
     return nullptr;
   }
   
-  return llvm::make_unique<ForExprAST>(id_name, std::move(start),
-				       std::move(end), std::move(step),
-				       std::move(body));
+  return arena.make<ForExprAST>(id_name, start, end, step, body);
 }
 
-std::unique_ptr<ExprAST> Parser::parseParenExpr()
+ExprAST * Parser::parseParenExpr()
 {
   getNextToken(); // consume the '('
   auto V = parseExpression();
@@ -155,26 +162,26 @@ std::unique_ptr<ExprAST> Parser::parseParenExpr()
   return V;
 }
 
-std::unique_ptr<ExprAST> Parser::parseIdentifierExpr()
+ExprAST * Parser::parseIdentifierExpr()
 {
-  std::string id_name = Lexer::instance()->identifierStr;
+  symbol_t id_name = Lexer::instance()->identifierSym;
 
   getNextToken(); // consume the identifier
   
   if (cur_tok != '(') // simple variable reference (not a function call)
   {
-	return llvm::make_unique<VariableExprAST>(id_name);
+	return arena.make<VariableExprAST>(id_name);
   }
   // call
   getNextToken(); // eat the '('
-  expr_ast_vector_t args;
+  llvm::SmallVector<ExprAST *, 8> args;
   if (cur_tok != ')') 
   {
     while (1) 
     {
       if (auto arg = parseExpression())
       {
-	args.push_back(std::move(arg));
+	args.push_back(arg);
       }
       else
       {
@@ -193,21 +200,21 @@ std::unique_ptr<ExprAST> Parser::parseIdentifierExpr()
   }
   // consume next ')'
   getNextToken();
-  return llvm::make_unique<CallExprAST>(id_name, std::move(args));
+  return arena.make<CallExprAST>(id_name, 
+				 arena.copy(llvm::makeArrayRef(args)));
 }
 
-std::unique_ptr<ExprAST> Parser::parseExpression()
+ExprAST * Parser::parseExpression()
 {
   auto lhs = parsePrimary();
   if (!lhs)
   {
     return nullptr;
   }
-  return parseBinOpRHS(0, std::move(lhs));
+  return parseBinOpRHS(0, lhs);
 }
 
-std::unique_ptr<ExprAST> Parser::parseBinOpRHS(int expr_prec,
-					       std::unique_ptr<ExprAST> lhs)
+ExprAST * Parser::parseBinOpRHS(int expr_prec, ExprAST * lhs)
 {
   // keep parsing until we run out of bin ops or until the precendence of the 
   // next bin op is too low
@@ -233,19 +240,18 @@ std::unique_ptr<ExprAST> Parser::parseBinOpRHS(int expr_prec,
     int next_prec = getTokPrecedence();
     if (tok_prec < next_prec)
     {
-      rhs = parseBinOpRHS(tok_prec+1, std::move(rhs));
+      rhs = parseBinOpRHS(tok_prec+1, rhs);
       if (!rhs)
       {
 	return nullptr;
       }
     }
     // put together the right and left hand sides
-    lhs = llvm::make_unique<BinaryExprAST>(bin_op, 
-					   std::move(lhs), std::move(rhs));
+    lhs = arena.make<BinaryExprAST>(bin_op, lhs, rhs);
   }
 }
 
-std::unique_ptr<ExprAST> Parser::parsePrimary()
+ExprAST * Parser::parsePrimary()
 {
   switch (cur_tok)
   {
@@ -282,7 +288,7 @@ std::unique_ptr<PrototypeAST> Parser::parsePrototype()
   {
     return Error::logP("Expected function name in prototype");
   }
-  std::string fn_name = Lexer::instance()->identifierStr;
+  symbol_t fn_name = Lexer::instance()->identifierSym;
   getNextToken();
 
   if (cur_tok != '(')
@@ -293,10 +299,10 @@ std::unique_ptr<PrototypeAST> Parser::parsePrototype()
 		       std::string(1, static_cast<char>(cur_tok))+
 		       "' ("+std::to_string(cur_tok)+")");
   }
-  string_vector_t arg_names;
+  symbol_vector_t arg_names;
   while (getNextToken() == tok_identifier)
   {
-    arg_names.push_back(Lexer::instance()->identifierStr);
+    arg_names.push_back(Lexer::instance()->identifierSym);
   }
   if (cur_tok != ')')
   {
@@ -309,6 +315,7 @@ std::unique_ptr<PrototypeAST> Parser::parsePrototype()
 
 std::unique_ptr<FunctionAST> Parser::parseDefinition()
 {
+  TimeReport::Timer timer(phase_parse);
   getNextToken(); // eat 'def'
   auto proto = parsePrototype();
   if (!proto)
@@ -318,59 +325,109 @@ std::unique_ptr<FunctionAST> Parser::parseDefinition()
   // the body
   if (auto e = parseExpression())
   {
-    return llvm::make_unique<FunctionAST>(std::move(proto), std::move(e));
+    return llvm::make_unique<FunctionAST>(std::move(proto), e);
   }
   return nullptr;
 }
 
 std::unique_ptr<PrototypeAST> Parser::parseExtern()
 {
+  TimeReport::Timer timer(phase_parse);
   getNextToken(); // eat 'extern'
   return parsePrototype();
 }
 
-std::unique_ptr<FunctionAST> Parser::parseTopLevelExpr()
+std::unique_ptr<FunctionAST> Parser::parseTopLevelExpr(symbol_t name)
 {
+  TimeReport::Timer timer(phase_parse);
   if (auto e = parseExpression())
   {
     // make an anonymous prototype
-    auto proto = llvm::make_unique<PrototypeAST>("__anon_expr",
-						 std::vector<std::string>());
-    return llvm::make_unique<FunctionAST>(std::move(proto), std::move(e));
+    auto proto = llvm::make_unique<PrototypeAST>(name, symbol_vector_t());
+    return llvm::make_unique<FunctionAST>(std::move(proto), e);
   }
   return nullptr;
 }
 
-void Parser::handleDefinition()
+llvm::Function * Parser::codegenFunction(FunctionAST & fn_ast)
+{
+  return Options::flat_ast ? fn_ast.codegenFlat() : fn_ast.codegen();
+}
+
+void Parser::analyze(FunctionAST & fn_ast)
 {
-  if (auto fn_ast = parseDefinition())
+  TimeReport::Timer timer(phase_analyze);
+  if (Options::fold)
+  {
+    fn_ast.simplifyBody(arena);
+  }
+  if (Options::infer_types)
   {
-    if (auto * fn_ir = fn_ast->codegen())
+    fn_ast.inferTypes();
+  }
+}
+
+// the IR of a new function, on the diagnostics of the compiler
+static void printIR(const llvm::Function & fn_ir)
+{
+  llvm::raw_os_ostream err(KCompiler::err());
+  fn_ir.print(err);
+}
+
+void Parser::handleDefinition()
+{
+  auto fn_ast = parseDefinition();
+  auto previous = fn_ast ? PrototypeAST::find(fn_ast->getName()) : nullptr;
+  if (previous &&
+      previous->getargs().size() != fn_ast->getProto().getargs().size())
+  {
+    // the callers compiled so far go through the stub of the name (see
+    // kjit.h) and pass the arguments of the previous definition
+    Error::log("Redefinition of '" +
+	       Symbols::name(fn_ast->getName()).str() +
+	       "' with another number of arguments");
+  }
+  else if (fn_ast)
+  {
+    TimeReport::nameItem(fn_ast->getName());
+    analyze(*fn_ast);
+    if (compile_pool)
     {
-      std::cout << "Parsed a function definition:" << std::endl;
-      fn_ir->print(llvm::errs());
-      std::cout << std::endl;
-      Codegen::jit->addModule(std::move(Codegen::the_module));
+      compile_pool->submit(std::move(fn_ast), arena);
+    }
+    else if (auto * fn_ir = codegenFunction(*fn_ast))
+    {
+      KCompiler::out() << "Parsed a function definition:" << std::endl;
+      printIR(*fn_ir);
+      KCompiler::out() << std::endl;
+      Inliner::instance().retain(fn_ast->getName(), *Codegen::the_module);
+      Inliner::instance().import(*Codegen::the_module, fn_ast->getName());
+      Codegen::getJIT().addModule(std::move(Codegen::the_module));
       Codegen::initializeModuleAndPassManager();
+      Inliner::instance().redefined(fn_ast->getName());
     }
   }
   else
   {
     getNextToken();
   }
+  // the IR is built, drop the whole tree at once
+  arena.reset();
 }
 
 void Parser::handleExtern()
 {
   if (auto proto_ast = parseExtern())
   {
+    TimeReport::nameItem(proto_ast->getname());
     if (auto * fn_ir = proto_ast->codegen())
     {
-      std::cout << "Parsed an extern:" << std::endl;
-      fn_ir->print(llvm::errs());
-      std::cout << "Function name: " << proto_ast->getname() << std::endl;
-      std::cout << std::endl;
-      PrototypeAST::function_protos[proto_ast->getname()] = std::move(proto_ast);
+      KCompiler::out() << "Parsed an extern:" << std::endl;
+      printIR(*fn_ir);
+      KCompiler::out() << "Function name: "
+		       << Symbols::name(proto_ast->getname()).str() << std::endl
+		       << std::endl;
+      PrototypeAST::addPrototype(std::move(proto_ast));
     }
   }
   else
@@ -379,61 +436,162 @@ void Parser::handleExtern()
   }
 }
 
+void Parser::handleCommand()
+{
+  auto words = Lexer::instance()->commandStr.split(' ');
+  llvm::StringRef arg = words.second.trim();
+  if (words.first == "opt")
+  {
+    OptLevel level;
+    if (Options::parseOptLevel(arg.str(), level))
+    {
+      if (compile_pool)
+      {
+	// definitions already submitted keep the level they were parsed with
+	compile_pool->drain();
+      }
+      Codegen::setOptLevel(level);
+      KCompiler::err() << "Optimization level "
+		       << Options::optLevelName(level) << std::endl;
+    }
+    else
+    {
+      Error::log("Unknown optimization level '" + arg.str() + "'");
+    }
+  }
+  else if (words.first == "profile")
+  {
+    if (!Profiler::enabled())
+    {
+      Error::log("Profiling is off, see --profile");
+    }
+    else if (arg == "reset")
+    {
+      Profiler::reset();
+    }
+    else if (arg.empty())
+    {
+      Profiler::print(KCompiler::err());
+    }
+    else
+    {
+      Error::log("Unknown profile command '" + arg.str() + "'");
+    }
+  }
+  else if (words.first == "fastmath")
+  {
+    FastMath mode;
+    if (Options::parseFastMath(arg.str(), mode))
+    {
+      if (compile_pool)
+      {
+	compile_pool->drain();
+      }
+      Codegen::setFastMath(mode);
+      KCompiler::err() << "Fast math " << Options::fastMathName(mode)
+		       << std::endl;
+    }
+    else
+    {
+      Error::log("Unknown fast math mode '" + arg.str() + "'");
+    }
+  }
+  else
+  {
+    Error::log("Unknown command ':" + Lexer::instance()->commandStr.str() + "'");
+  }
+  getNextToken();
+}
+
 void Parser::handleTopLevelExpression()
 {
+  if (compile_pool)
+  {
+    // the expression may call any of the definitions still being compiled
+    compile_pool->drain();
+  }
   // evaluate the top-level expression into an anonymous functions
   if (auto fn_ast = parseTopLevelExpr())
   {
-    if (fn_ast->codegen())
+    analyze(*fn_ast);
+    FlatAST flat;
+    fn_ast->flattenBody(flat);
+    if (auto * num = fn_ast->getConstantBody())
     {
-      auto h = Codegen::jit->addModule(std::move(Codegen::the_module));
+      // folded away entirely, nothing to run
+      KCompiler::err() << "Evaluated to " << num->getVal() << std::endl;
+    }
+    else if (!Interpreter::worthCompiling(flat, Options::interp_threshold))
+    {
+      // cheaper to walk the expression once than to compile it
+      TimeReport::Timer timer(phase_execute);
+      double result;
+      if (Interpreter(flat).run(result))
+      {
+	KCompiler::err() << "Evaluated to " << result << std::endl;
+      }
+    }
+    else if (Options::flat_ast ? fn_ast->codegenFlat(flat) : fn_ast->codegen())
+    {
+      Inliner::instance().import(*Codegen::the_module, fn_ast->getName());
+      auto h = Codegen::getJIT().addModule(std::move(Codegen::the_module));
       Codegen::initializeModuleAndPassManager();
 
-      // Search the JIT for the __anon_expr symbol
-      auto ExprSymbol = Codegen::jit->findSymbol("__anon_expr");
-      assert(ExprSymbol && "Function not found");
-
-      // get the symbols' address and cast it to the right type (takes no
-      // arguments, returns a double) so we can call it as a native function
-      double (*fp)() = 
-	(double(*)())(intptr_t)cantFail(ExprSymbol.getAddress());
+      double (*fp)();
+      {
+	// resolving the address finalizes (relocates) the code
+	TimeReport::Timer timer(phase_link);
+	// Search the JIT for the __anon_expr symbol
+	auto ExprSymbol = Codegen::getJIT().findSymbol("__anon_expr");
+	assert(ExprSymbol && "Function not found");
+
+	// get the symbols' address and cast it to the right type (takes no
+	// arguments, returns a double) so we can call it as a native function
+	fp = (double(*)())(intptr_t)cantFail(ExprSymbol.getAddress());
 	//(double(*)())(intptr_t)cantFail(ExprSymbol.getSymbolAddressInProcess());
-      std::cerr << "Evaluated to " << fp() << std::endl;
+      }
+      double result;
+      {
+	TimeReport::Timer timer(phase_execute);
+	result = fp();
+      }
+      KCompiler::err() << "Evaluated to " << result << std::endl;
 
       // Delete the anonymous expression module from the JIT
-      Codegen::jit->removeModule(h);
+      Codegen::getJIT().removeModule(h);
     }
   }
   else
   {
     getNextToken();
   }
+  arena.reset();
 }
 
 // get the precedence given a binary operator
 int Parser::getTokPrecedence()
 {
-  int tok_prec;
   // invalid token
   if (!isascii(cur_tok))
   {
     return -1;
   }
-  // try finding the operator in the table
-  tok_prec = binop_precedence[cur_tok];
+  // try finding the operator in the table, shared by the parsers of all
+  // threads and only read
+  auto prec = binop_precedence.find(cur_tok);
   // not found
-  if (tok_prec <= 0)
+  if (prec == binop_precedence.end() || prec->second <= 0)
   {
     return -1;
   }
-  return tok_prec;
+  return prec->second;
 }
 
 void Parser::mainloop()
 {
   while (1)
   {
-        std::cerr << "ready> ";
+	KCompiler::prompt();
 	switch (cur_tok)
 	{
 	case tok_eof:
@@ -447,16 +605,25 @@ void Parser::mainloop()
 	}
 	case tok_def:
 	{
+	  TimeReport::beginItem("def");
 	  handleDefinition();
 	  break;
 	}
 	case tok_extern:
 	{
+	  TimeReport::beginItem("extern");
 	  handleExtern();
 	  break;
 	}
+	case tok_command:
+	{
+	  TimeReport::beginItem("command");
+	  handleCommand();
+	  break;
+	}
 	default:
 	{
+	  TimeReport::beginItem("expr");
 	  handleTopLevelExpression();
 	  break;
 	}
@@ -466,5 +633,137 @@ void Parser::mainloop()
 
 void Parser::parse()
 {
+  if (Options::jobs > 1)
+  {
+    compile_pool = llvm::make_unique<CompilePool>(KCompiler::current(),
+						  Options::jobs);
+  }
   mainloop();
+  if (compile_pool)
+  {
+    compile_pool->drain();
+    compile_pool.reset();
+  }
+}
+
+void Parser::handleBatchDefinition()
+{
+  auto fn_ast = parseDefinition();
+  if (!fn_ast)
+  {
+    getNextToken();
+  }
+  else if (Codegen::functions.count(fn_ast->getName()) &&
+	   !Codegen::functions[fn_ast->getName()]->isDeclaration())
+  {
+    Error::log("Redefinition of '" + 
+	       Symbols::name(fn_ast->getName()).str() + 
+	       "' is not supported in batch mode");
+  }
+  else
+  {
+    TimeReport::nameItem(fn_ast->getName());
+    analyze(*fn_ast);
+    codegenFunction(*fn_ast);
+  }
+  arena.reset();
+}
+
+symbol_vector_t Parser::parseProgram()
+{
+  // every item goes into the single module opened by the caller, top-level
+  // expressions become __anon_expr.N functions
+  symbol_vector_t entry_points;
+  while (cur_tok != tok_eof)
+  {
+    switch (cur_tok)
+    {
+    case ';':
+    {
+      getNextToken();
+      break;
+    }
+    case tok_def:
+    {
+      TimeReport::beginItem("def");
+      handleBatchDefinition();
+      break;
+    }
+    case tok_extern:
+    {
+      TimeReport::beginItem("extern");
+      handleExtern();
+      break;
+    }
+    case tok_command:
+    {
+      TimeReport::beginItem("command");
+      handleCommand();
+      break;
+    }
+    default:
+    {
+      TimeReport::beginItem("expr");
+      symbol_t name = Symbols::intern(Symbols::name(sym_anon_expr).str() + 
+				      "." + std::to_string(entry_points.size()));
+      auto fn_ast = parseTopLevelExpr(name);
+      if (!fn_ast)
+      {
+	getNextToken();
+	arena.reset();
+	break;
+      }
+      TimeReport::nameItem(name);
+      analyze(*fn_ast);
+      if (codegenFunction(*fn_ast))
+      {
+	entry_points.push_back(name);
+      }
+      arena.reset();
+      break;
+    }
+    }
+  }
+
+  return entry_points;
+}
+
+void Parser::parseBatch()
+{
+  // the entry points run in order once the whole program has been optimized
+  // and JIT-ed
+  symbol_vector_t entry_points = parseProgram();
+  TimeReport::beginItem("program");
+  Codegen::optimizeWholeProgram(*Codegen::the_module);
+  Codegen::getJIT().addModule(std::move(Codegen::the_module));
+  Codegen::initializeModuleAndPassManager();
+
+  for (symbol_t name : entry_points)
+  {
+    double (*fp)();
+    {
+      TimeReport::Timer timer(phase_link);
+      auto ExprSymbol =
+	Codegen::getJIT().findSymbol(Symbols::name(name).str());
+      assert(ExprSymbol && "Function not found");
+      fp = (double(*)())(intptr_t)cantFail(ExprSymbol.getAddress());
+    }
+    double result;
+    {
+      TimeReport::Timer timer(phase_execute);
+      result = fp();
+    }
+    KCompiler::err() << "Evaluated to " << result << std::endl;
+  }
+}
+
+void Parser::printStats()
+{
+  // without the arena every node was a separate heap allocation (plus one
+  // for the argument vector of each call)
+  KCompiler::err()
+    << "AST nodes allocated:      " << arena.getNumNodes() << std::endl
+    << "AST arena slab mallocs:   " << arena.getNumSlabs() << std::endl
+    << "Largest top-level tree:   " << arena.getMaxBytes() << " bytes"
+    << std::endl;
 }
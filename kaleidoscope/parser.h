@@ -6,6 +6,9 @@
 
 #include "lexer.h"
 #include "ast.h"
+#include "arena.h"
+
+class CompilePool;
 
 typedef std::map<char, int> binop_precedence_t;
 
@@ -15,70 +18,105 @@ public:
   BinopPrecedenceConstructor();
 };
 
-// Parser for Kaleidoscope
+// Parser for Kaleidoscope, one per compiler (see kcomp.h), reading the
+// tokens of its lexer
 class Parser {
 private:
   friend class BinopPrecedenceConstructor; // needs to acess the precedence table
 
-  static int cur_tok;
-  static binop_precedence_t binop_precedence; // bin op precendence table
+  int cur_tok = tok_eof;
+  // bin op precendence table, the same for every parser
+  static binop_precedence_t binop_precedence;
   static BinopPrecedenceConstructor binop_precedence_constructor;
+  ASTArena arena; // expression nodes of the current top-level item
+  std::unique_ptr<CompilePool> compile_pool; // with -j N, else null
   
 private:
   // numberexpr ::= number
-  static std::unique_ptr<ExprAST> parseNumberExpr();
+  ExprAST * parseNumberExpr();
   // ifexpr ::= 'if' expression 'then' expression 'else' expression
-  static std::unique_ptr<ExprAST> parseIfExpr();
+  ExprAST * parseIfExpr();
   // forexpr::= 'for' identifier '=' expr ',' expr (',' expr)? 'in' expression
-  static std::unique_ptr<ExprAST> parseForExpr();
+  ExprAST * parseForExpr();
  
   // parenexpr ::= '(' expression ')'
-  static std::unique_ptr<ExprAST> parseParenExpr();
+  ExprAST * parseParenExpr();
   // identifierexpr
   //   ::= identifier
   //   ::= identifier '(' expression * ')'
-  static std::unique_ptr<ExprAST> parseIdentifierExpr();
+  ExprAST * parseIdentifierExpr();
   // expression 
   //   ::= binary binoprhs
-  static std::unique_ptr<ExprAST> parseExpression();
+  ExprAST * parseExpression();
   // binoprhs
   //   ::= (['+'|'-'|'<'|'*']primary)*
-  static std::unique_ptr<ExprAST> parseBinOpRHS(int expr_prec, 
-                                                std::unique_ptr<ExprAST> lhs);
+  ExprAST * parseBinOpRHS(int expr_prec, ExprAST * lhs);
   // primary
   //   ::= identifierexpr
   //   ::= numberexpr
   //   ::= parenexpr
-  static std::unique_ptr<ExprAST> parsePrimary();
+  ExprAST * parsePrimary();
 
   // prototype
   //   ::= id '(' id* ')'
-  static std::unique_ptr<PrototypeAST> parsePrototype();
-
-  // definition
-  //   ::= 'def' prototype expression
-  static std::unique_ptr<FunctionAST> parseDefinition();
+  std::unique_ptr<PrototypeAST> parsePrototype();
 
   // external 
   //   ::= 'extern' prototype
-  static std::unique_ptr<PrototypeAST> parseExtern();
+  std::unique_ptr<PrototypeAST> parseExtern();
 
-  // toplevelexpr
-  //   ::= expression
-  static std::unique_ptr<FunctionAST> parseTopLevelExpr();
+  void handleDefinition();
+  void handleExtern();
+  void handleTopLevelExpression();
+  void handleBatchDefinition();
+  // ':' commands changing the compiler settings
+  //   :opt <0-3|fast-compile>  optimization level of the following items
+  //   :fastmath <on|contract|off>  fast-math flags of the following items
+  //   :profile [reset]         print or clear the profile (see profile.h)
+  void handleCommand();
 
-  static void handleDefinition();
-  static void handleExtern();
-  static void handleTopLevelExpression();
+  // codegen with the walker selected on the command line
+  llvm::Function * codegenFunction(FunctionAST & fn_ast);
 
   // get the precedence given a binary operator
-  static int getTokPrecedence();
+  int getTokPrecedence();
 
-  static void mainloop();
+  void mainloop();
 
  public:
-  static int getNextToken();
-  static void parse();
+  Parser();
+  ~Parser();
+
+  int getNextToken();
+  // the lookahead token
+  int getCurrentToken() { return cur_tok; }
+  void parse();
+  // parse the entire input into the current module, top-level expressions
+  // become functions named __anon_expr.N, returned in source order
+  symbol_vector_t parseProgram();
+  // whole-program mode: compile the entire input into one module, optimize
+  // it interprocedurally, JIT it once and then run the top-level expressions
+  void parseBatch();
+
+  // definition
+  //   ::= 'def' prototype expression
+  std::unique_ptr<FunctionAST> parseDefinition();
+
+  // toplevelexpr
+  //   ::= expression
+  std::unique_ptr<FunctionAST> parseTopLevelExpr(
+    symbol_t name = sym_anon_expr);
+
+  // AST level constant folding and type inference, unless disabled on the
+  // command line; done before the prototype of a definition is published
+  void analyze(FunctionAST & fn_ast);
+
+  // arena holding the expression nodes of the item being parsed, callers
+  // of parseDefinition/parseTopLevelExpr reset it when done with the tree
+  ASTArena & getArena() { return arena; }
+
+  // print AST allocation statistics
+  void printStats();
 };
 
 #endif
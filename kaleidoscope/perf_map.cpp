@@ -0,0 +1,64 @@
+#include "perf_map.h"
+#include "error.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+
+#include <unistd.h>
+
+PerfMapListener::PerfMapListener()
+{
+  std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+  std::error_code ec;
+  out = llvm::make_unique<llvm::raw_fd_ostream>(path, ec, 
+						llvm::sys::fs::F_Text);
+  if (ec)
+  {
+    Error::log("Could not open " + path + ": " + ec.message());
+    out.reset();
+  }
+}
+
+void PerfMapListener::NotifyObjectEmitted(
+  const llvm::object::ObjectFile & obj,
+  const llvm::RuntimeDyld::LoadedObjectInfo & info)
+{
+  if (!out)
+  {
+    return;
+  }
+  // the sections of the debug object are at the addresses they were loaded
+  // to, so are its symbols
+  auto debug_obj = info.getObjectForDebug(obj);
+  if (!debug_obj.getBinary())
+  {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto & sym_size :
+	 llvm::object::computeSymbolSizes(*debug_obj.getBinary()))
+  {
+    const llvm::object::SymbolRef & sym = sym_size.first;
+    auto type = sym.getType();
+    if (!type || *type != llvm::object::SymbolRef::ST_Function)
+    {
+      llvm::consumeError(type.takeError());
+      continue;
+    }
+    auto name = sym.getName();
+    auto addr = sym.getAddress();
+    if (!name || !addr)
+    {
+      llvm::consumeError(name.takeError());
+      llvm::consumeError(addr.takeError());
+      continue;
+    }
+    *out << llvm::format_hex_no_prefix(*addr, 1) << " "
+	 << llvm::format_hex_no_prefix(sym_size.second, 1) << " " << *name
+	 << "\n";
+  }
+  // perf may read it while the process runs
+  out->flush();
+}
@@ -0,0 +1,30 @@
+#ifndef _PERF_MAP_H_
+#define _PERF_MAP_H_
+
+#include <mutex>
+
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/Support/raw_ostream.h"
+
+// JIT event listener writing the perf map of the process,
+// /tmp/perf-<pid>.map: one "start size name" line per function of every
+// object the JIT loads, which perf report reads to name samples in code
+// it finds no binary for. Unlike the jitdump of the perf listener of LLVM
+// it needs no perf inject step, nor an LLVM built with perf support.
+//
+// perf has no way to forget a mapping, the lines of removed code (of
+// top-level expressions) stay until the process exits.
+class PerfMapListener : public llvm::JITEventListener {
+ private:
+  std::mutex mutex;
+  std::unique_ptr<llvm::raw_fd_ostream> out; // null if it could not be opened
+
+ public:
+  PerfMapListener();
+
+  void NotifyObjectEmitted(const llvm::object::ObjectFile & obj,
+			   const llvm::RuntimeDyld::LoadedObjectInfo & info)
+    override;
+};
+
+#endif
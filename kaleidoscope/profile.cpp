@@ -0,0 +1,157 @@
+#include "profile.h"
+#include "codegen.h"
+#include "options.h"
+
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Support/DynamicLibrary.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <vector>
+
+llvm::StringMap<Profiler::Record> Profiler::records;
+std::mutex Profiler::mutex;
+
+bool Profiler::enabled()
+{
+  return Options::profile != profile_off;
+}
+
+llvm::GlobalVariable * Profiler::getRecord(symbol_t name)
+{
+  std::string symbol = "__kprof." + Symbols::name(name).str();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto inserted = records.insert(std::make_pair(Symbols::name(name),
+						  Record()));
+    if (inserted.second)
+    {
+      llvm::sys::DynamicLibrary::AddSymbol(symbol,
+					   &inserted.first->second);
+    }
+  }
+
+  auto & context = Codegen::the_context;
+  llvm::Type * i64 = llvm::Type::getInt64Ty(context);
+  llvm::StructType * record_ty =
+    llvm::StructType::get(context, {i64, i64, i64});
+  if (auto * gv = Codegen::the_module->getNamedGlobal(symbol))
+  {
+    return gv;
+  }
+  return new llvm::GlobalVariable(*Codegen::the_module, record_ty, false,
+				  llvm::GlobalValue::ExternalLinkage, nullptr,
+				  symbol);
+}
+
+// record.field += delta, the generated code runs on a single thread,
+// returns the new value
+static llvm::Value * emitAdd(llvm::GlobalVariable * record, unsigned field,
+			     llvm::Value * delta, const char * name)
+{
+  auto & builder = Codegen::builder;
+  llvm::Type * i64 = llvm::Type::getInt64Ty(Codegen::the_context);
+  llvm::Value * ptr =
+    builder.CreateStructGEP(record->getValueType(), record, field);
+  llvm::Value * sum = builder.CreateAdd(builder.CreateLoad(i64, ptr), delta,
+					name);
+  builder.CreateStore(sum, ptr);
+  return sum;
+}
+
+llvm::Value * Profiler::emitEnter(symbol_t name)
+{
+  llvm::GlobalVariable * record = getRecord(name);
+  llvm::Value * one =
+    llvm::ConstantInt::get(llvm::Type::getInt64Ty(Codegen::the_context), 1);
+  emitAdd(record, 0, one, "prof.calls");
+  if (Options::profile != profile_time)
+  {
+    return nullptr;
+  }
+  emitAdd(record, 2, one, "prof.depth");
+  return Codegen::builder.CreateCall(
+    llvm::Intrinsic::getDeclaration(Codegen::the_module.get(),
+				    llvm::Intrinsic::readcyclecounter),
+    {}, "prof.start");
+}
+
+void Profiler::emitExit(symbol_t name, llvm::Value * start)
+{
+  if (!start)
+  {
+    return;
+  }
+  llvm::Value * end = Codegen::builder.CreateCall(
+    llvm::Intrinsic::getDeclaration(Codegen::the_module.get(),
+				    llvm::Intrinsic::readcyclecounter),
+    {}, "prof.end");
+  auto & builder = Codegen::builder;
+  llvm::GlobalVariable * record = getRecord(name);
+  llvm::Type * i64 = llvm::Type::getInt64Ty(Codegen::the_context);
+  llvm::Value * depth = emitAdd(record, 2, llvm::ConstantInt::get(i64, -1),
+				"prof.depth");
+  // the cycles of a nested activation are counted by the outermost one
+  llvm::Value * outermost =
+    builder.CreateICmpEQ(depth, llvm::ConstantInt::get(i64, 0), "prof.outer");
+  llvm::Value * cycles =
+    builder.CreateSelect(outermost, builder.CreateSub(end, start),
+			 llvm::ConstantInt::get(i64, 0), "prof.delta");
+  emitAdd(record, 1, cycles, "prof.cycles");
+}
+
+void Profiler::print(std::ostream & out)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<const llvm::StringMapEntry<Record> *> called;
+  for (auto & entry : records)
+  {
+    if (entry.second.calls)
+    {
+      called.push_back(&entry);
+    }
+  }
+  std::sort(called.begin(), called.end(),
+	    [](const llvm::StringMapEntry<Record> * a,
+	       const llvm::StringMapEntry<Record> * b) {
+	      if (a->second.cycles != b->second.cycles)
+	      {
+		return a->second.cycles > b->second.cycles;
+	      }
+	      return a->second.calls > b->second.calls;
+	    });
+
+  bool time = Options::profile == profile_time;
+  std::ios_base::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+  out << std::left << std::setw(24) << "function" << std::right
+      << std::setw(14) << "calls";
+  if (time)
+  {
+    out << std::setw(18) << "cycles" << std::setw(14) << "cycles/call";
+  }
+  out << std::endl;
+  for (auto * entry : called)
+  {
+    const Record & r = entry->second;
+    out << std::left << std::setw(24) << entry->first().str() << std::right
+	<< std::setw(14) << r.calls;
+    if (time)
+    {
+      out << std::setw(18) << r.cycles << std::setw(14) << std::fixed
+	  << std::setprecision(1) << double(r.cycles) / r.calls;
+    }
+    out << std::endl;
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+void Profiler::reset()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto & entry : records)
+  {
+    entry.second = Record();
+  }
+}
@@ -0,0 +1,56 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+
+#include "k_llvm.h"
+#include "llvm/ADT/StringMap.h"
+#include "symbol.h"
+
+// Profiler - instrumentation of the generated functions (--profile). Every
+// definition counts its calls in a record of the runtime table below and,
+// with --profile time, adds the cycle counter ticks from its entry to its
+// return (inclusive of callees) to it. The record counts the activations
+// in progress so that a recursion only adds the cycles of its outermost
+// call, nested ones being included in them already.
+//
+// The generated code refers to the record of a function as the external
+// global __kprof.<name>, which the JIT resolves from the symbols the
+// profiler adds to the process, so the IR does not depend on where the
+// table is (and can be cached). Redefinitions share the record of the
+// name.
+class Profiler {
+ public:
+  struct Record {
+    uint64_t calls = 0;
+    uint64_t cycles = 0;
+    uint64_t depth = 0;   // activations not returned yet (time only)
+  };
+
+ private:
+  // records by function name, the entries never move once inserted
+  static llvm::StringMap<Record> records;
+  // definitions are instrumented on the compile threads
+  static std::mutex mutex;
+
+  // declaration of the record of name in the current module
+  static llvm::GlobalVariable * getRecord(symbol_t name);
+
+ public:
+  static bool enabled();
+
+  // at the start of the entry block: count the call (and the activation),
+  // returns the cycle counter to pass to emitExit(), null when not timing
+  static llvm::Value * emitEnter(symbol_t name);
+  // before the return: end the activation and, in the outermost one,
+  // account the cycles since start
+  static void emitExit(symbol_t name, llvm::Value * start);
+
+  // the functions called so far, by inclusive cycles (or calls)
+  static void print(std::ostream & out);
+  static void reset();
+};
+
+#endif
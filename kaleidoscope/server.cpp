@@ -0,0 +1,205 @@
+#include "server.h"
+#include "error.h"
+#include "kcomp.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// time a client has to send its whole request, and to take each part of
+// the answer, before its session gives up on it
+static const int client_timeout_seconds = 30;
+
+// the whole request, until the client shuts down writing; false if it
+// does not within the timeout
+static bool readAll(int fd, std::string & source)
+{
+  auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::seconds(client_timeout_seconds);
+  char buf[4096];
+  while (1)
+  {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - std::chrono::steady_clock::now()).count();
+    if (left <= 0)
+    {
+      return false;
+    }
+    pollfd pfd = { fd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, left);
+    if (ready == 0)
+    {
+      return false;
+    }
+    ssize_t n = ready < 0 ? -1 : read(fd, buf, sizeof(buf));
+    if (n == 0)
+    {
+      return true;
+    }
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+	continue;
+      }
+      return false;
+    }
+    source.append(buf, n);
+  }
+}
+
+// the client of the session of this process
+static int session_fd = -1;
+
+// a fatal signal in the session, most likely a stack overflow of a runaway
+// recursion in the JIT-ed code: only async-signal-safe calls from here
+static void sessionCrashed(int sig)
+{
+  static const char message[] = "\nSession aborted by a fatal signal"
+    " (stack overflow?)\n";
+  ssize_t ignored = send(session_fd, message, sizeof(message) - 1,
+			 MSG_NOSIGNAL);
+  (void)ignored;
+  _exit(128 + sig);
+}
+
+// report the crash of the session to its client; the handler runs on a
+// stack of its own, the one of the session may be exhausted
+static void catchCrashes(int fd)
+{
+  static char handler_stack[1 << 16];
+  session_fd = fd;
+  stack_t ss;
+  memset(&ss, 0, sizeof(ss));
+  ss.ss_sp = handler_stack;
+  ss.ss_size = sizeof(handler_stack);
+  sigaltstack(&ss, nullptr);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = sessionCrashed;
+  sa.sa_flags = SA_ONSTACK | SA_RESETHAND;
+  sigemptyset(&sa.sa_mask);
+  for (int sig : { SIGSEGV, SIGBUS, SIGILL, SIGFPE })
+  {
+    sigaction(sig, &sa, nullptr);
+  }
+}
+
+void CompileServer::serve(int fd, KCompiler & compiler)
+{
+  catchCrashes(fd);
+  // a client that went away must not kill the session with SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+  timeval timeout = { client_timeout_seconds, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  std::string source;
+  if (readAll(fd, source))
+  {
+    // the diagnostics and the results of the compiler as well as what the
+    // JIT-ed code prints (see externs.cpp) go to the client, in order
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    std::cout << std::unitbuf;
+    compiler.prompts = false;
+    compiler.lexer.setInputString(source);
+    compiler.run();
+    std::cout.flush();
+    fflush(stdout);
+  }
+  close(fd);
+}
+
+int CompileServer::run(const std::string & path, unsigned workers)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+  {
+    Error::log("Socket path too long: " + path);
+    return 1;
+  }
+  strcpy(addr.sun_path, path.c_str());
+
+  // the socket of a previous server, never any other file
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+  {
+    unlink(path.c_str());
+  }
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0 ||
+      bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(listen_fd, SOMAXCONN) < 0)
+  {
+    Error::log("Cannot listen on " + path + ": " + strerror(errno));
+    return 1;
+  }
+  std::cerr << "Listening on " << path << " with " << workers << " workers"
+	    << std::endl;
+
+  // the server stays single threaded, so that it can fork the sessions;
+  // the connections wait in the listen queue for a free worker. The
+  // compiler of the next session, with its JIT, target machine and pass
+  // pipelines, is set up while waiting for it, its process takes it over
+  std::unique_ptr<KCompiler> next;
+  unsigned running = 0;
+  while (1)
+  {
+    if (!next)
+    {
+      next = llvm::make_unique<KCompiler>();
+      next->createJIT();
+    }
+    while (running > 0 && waitpid(-1, nullptr, WNOHANG) > 0)
+    {
+      --running;
+    }
+    if (running == workers)
+    {
+      if (waitpid(-1, nullptr, 0) > 0)
+      {
+	--running;
+      }
+      continue;
+    }
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0)
+    {
+      if (errno != EINTR && errno != ECONNABORTED)
+      {
+	Error::log(std::string("accept: ") + strerror(errno));
+      }
+      continue;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(listen_fd);
+      serve(fd, *next);
+      // not the atexit handlers and static destructors of the server
+      _exit(0);
+    }
+    if (pid < 0)
+    {
+      Error::log(std::string("fork: ") + strerror(errno));
+    }
+    else
+    {
+      ++running;
+      next.reset();
+    }
+    close(fd);
+  }
+}
@@ -0,0 +1,39 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <string>
+
+// CompileServer - the compiler as a daemon (--server PATH). It initializes
+// the target and loads the symbols of the process once, then accepts
+// connections on a Unix domain socket at PATH. A client writes a REPL
+// session, shuts down its side of the connection and reads back what the
+// session printed: the IR, the results and the diagnostics, without
+// prompts, and the output of its code (putchard, printd).
+//
+// Each connection is served by a process forked for it, up to --workers N
+// at once, the others wait to be accepted. The server sets up the compiler
+// of the next session ahead, while waiting for it: the JIT with its target
+// machine, the object cache and the pass pipelines of the first module.
+// The process forked for the session takes it over, so that only the
+// fork stands between accepting a connection and compiling it; --workers
+// bounds the sessions running at once, it is not a pool of resident
+// processes. The JIT runs the code of the client in that process, so a session that crashes (a runaway recursion
+// overflowing the stack) only ends itself, and its client is told. Nothing
+// of a session outlives it: its definitions, profile (:profile) and symbols
+// are those of its process. A client that does not send its whole request,
+// or take the answer, within a timeout loses its session; a session that
+// computes forever keeps its worker, there is no limit on its run time.
+class KCompiler;
+
+class CompileServer {
+  // compile the session read from the client fd with compiler, answer and
+  // close it, in the process forked for the session
+  static void serve(int fd, KCompiler & compiler);
+
+ public:
+  // listen on path and serve forever; returns the exit status if the
+  // socket cannot be set up
+  static int run(const std::string & path, unsigned workers);
+};
+
+#endif
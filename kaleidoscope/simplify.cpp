@@ -0,0 +1,178 @@
+#include "simplify.h"
+#include "ast.h"
+#include <cmath>
+
+void FunctionAST::simplifyBody(ASTArena & arena)
+{
+  Simplifier s(arena, proto->getargs());
+  body = body->simplify(s);
+}
+
+ExprAST * BinaryExprAST::simplify(Simplifier & s)
+{
+  lhs = lhs->simplify(s);
+  rhs = rhs->simplify(s);
+  const NumberExprAST * l = lhs->asNumber();
+  const NumberExprAST * r = rhs->asNumber();
+
+  if (l && r)
+  {
+    double lv = l->getVal();
+    double rv = r->getVal();
+    switch (op)
+    {
+    case '+':
+      return s.getArena().make<NumberExprAST>(lv + rv);
+    case '-':
+      return s.getArena().make<NumberExprAST>(lv - rv);
+    case '*':
+      return s.getArena().make<NumberExprAST>(lv * rv);
+    case '<':
+      // fcmp ult: true when less or unordered
+      return s.getArena().make<NumberExprAST>(!(lv >= rv) ? 1.0 : 0.0);
+    default:
+      // left to codegen to report
+      return this;
+    }
+  }
+
+  // identities that hold for every double, NaNs, infinities and signed
+  // zeros included (x + 0.0 does not: -0.0 + 0.0 is +0.0)
+  if (op == '*' && r && r->getVal() == 1.0)
+  {
+    return lhs;
+  }
+  if (op == '*' && l && l->getVal() == 1.0)
+  {
+    return rhs;
+  }
+  if (op == '-' && r && r->getVal() == 0.0 && !std::signbit(r->getVal()))
+  {
+    return lhs;
+  }
+  return this;
+}
+
+bool BinaryExprAST::hasSideEffects() const
+{
+  return lhs->hasSideEffects() || rhs->hasSideEffects();
+}
+
+bool BinaryExprAST::isValid(Simplifier & s) const
+{
+  return (op == '+' || op == '-' || op == '*' || op == '<') &&
+    lhs->isValid(s) && rhs->isValid(s);
+}
+
+bool VariableExprAST::isValid(Simplifier & s) const
+{
+  return s.inScope(name);
+}
+
+ExprAST * CallExprAST::simplify(Simplifier & s)
+{
+  // the argument list lives in the arena as well and is ours to update
+  for (ExprAST *& arg : args)
+  {
+    arg = arg->simplify(s);
+  }
+  return this;
+}
+
+bool CallExprAST::isValid(Simplifier & s) const
+{
+  auto proto = PrototypeAST::find(callee);
+  if (!proto || proto->getargs().size() != args.size())
+  {
+    return false;
+  }
+  for (ExprAST * arg : args)
+  {
+    if (!arg->isValid(s))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+ExprAST * IfExprAST::simplify(Simplifier & s)
+{
+  Cond = Cond->simplify(s);
+  Then = Then->simplify(s);
+  Else = Else->simplify(s);
+
+  if (const NumberExprAST * c = Cond->asNumber())
+  {
+    ExprAST * taken = Simplifier::isTrue(c->getVal()) ? Then : Else;
+    ExprAST * dropped = taken == Then ? Else : Then;
+    if (dropped->isValid(s))
+    {
+      return taken;
+    }
+  }
+  return this;
+}
+
+bool IfExprAST::hasSideEffects() const
+{
+  return Cond->hasSideEffects() || Then->hasSideEffects() || 
+    Else->hasSideEffects();
+}
+
+bool IfExprAST::isValid(Simplifier & s) const
+{
+  return Cond->isValid(s) && Then->isValid(s) && Else->isValid(s);
+}
+
+ExprAST * ForExprAST::simplify(Simplifier & s)
+{
+  start = start->simplify(s);
+  s.pushVariable(var_name);
+  end = end->simplify(s);
+  if (step)
+  {
+    step = step->simplify(s);
+  }
+  body = body->simplify(s);
+
+  // the value of the body is thrown away, so a body without effects is
+  // dead; the loop itself stays as it may not terminate
+  if (!body->asNumber() && !body->hasSideEffects() && body->isValid(s))
+  {
+    body = s.getArena().make<NumberExprAST>(0.0);
+  }
+  s.popVariable();
+
+  // with a constant false end condition the loop runs exactly once, and
+  // without any effect in it all that is left is its value
+  const NumberExprAST * e = end->asNumber();
+  if (e && !Simplifier::isTrue(e->getVal()) && body->asNumber() &&
+      !start->hasSideEffects() && start->isValid(s) &&
+      (!step || (!step->hasSideEffects() && isValidInLoop(s, step))))
+  {
+    return s.getArena().make<NumberExprAST>(0.0);
+  }
+  return this;
+}
+
+bool ForExprAST::isValidInLoop(Simplifier & s, const ExprAST * e) const
+{
+  s.pushVariable(var_name);
+  bool valid = e->isValid(s);
+  s.popVariable();
+  return valid;
+}
+
+bool ForExprAST::isValid(Simplifier & s) const
+{
+  if (!start->isValid(s))
+  {
+    return false;
+  }
+  s.pushVariable(var_name);
+  bool valid = end->isValid(s) && (!step || step->isValid(s)) && 
+    body->isValid(s);
+  s.popVariable();
+  return valid;
+}
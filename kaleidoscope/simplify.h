@@ -0,0 +1,40 @@
+#ifndef _SIMPLIFY_H_
+#define _SIMPLIFY_H_
+
+#include <algorithm>
+
+#include "arena.h"
+#include "symbol.h"
+#include "llvm/ADT/SmallVector.h"
+
+// Simplifier - state of the AST simplification pass run on a function
+// body before IR is built: constant arithmetic and comparisons are folded,
+// 'if' with a constant condition is replaced by the branch taken, and the
+// ignored value of a 'for' body is dropped when computing it has no
+// effect. The folded values are bit for bit those the emitted IR would
+// compute at run time. Replacement nodes are allocated in the arena of the
+// tree.
+class Simplifier {
+ private:
+  ASTArena & arena;
+  llvm::SmallVector<symbol_t, 8> scope; // arguments and loop variables
+
+ public:
+  Simplifier(ASTArena & arena, const symbol_vector_t & args)
+    : arena(arena), scope(args.begin(), args.end()) {}
+
+  ASTArena & getArena() { return arena; }
+
+  void pushVariable(symbol_t name) { scope.push_back(name); }
+  void popVariable() { scope.pop_back(); }
+  bool inScope(symbol_t name) const
+  {
+    return std::find(scope.begin(), scope.end(), name) != scope.end();
+  }
+
+  // truth value of a condition as tested by the IR (ordered, not equal
+  // to 0.0)
+  static bool isTrue(double cond) { return cond < 0.0 || cond > 0.0; }
+};
+
+#endif
@@ -0,0 +1,46 @@
+#include "symbol.h"
+#include <cassert>
+
+Symbols::Symbols()
+{
+  // must follow the order of ReservedSymbol
+  static const char * const reserved[] = {
+    "def", "if", "then", "else", "for", "in", "extern", "__anon_expr"
+  };
+  static_assert(sizeof(reserved) / sizeof(reserved[0]) == sym_num_reserved,
+		"reserved symbol table out of sync");
+  for (const char * name : reserved)
+  {
+    symbol_t sym = names.size();
+    auto entry = ids.insert(std::make_pair(name, sym));
+    names.push_back(entry.first->getKey());
+  }
+}
+
+Symbols & Symbols::table()
+{
+  // constructed on first use so the table is ready before any lexing
+  static Symbols symbols;
+  return symbols;
+}
+
+symbol_t Symbols::intern(llvm::StringRef name)
+{
+  Symbols & t = table();
+  std::lock_guard<std::mutex> lock(t.mutex);
+  auto entry = t.ids.insert(std::make_pair(name, symbol_t(t.names.size())));
+  if (entry.second)
+  {
+    // the map entry owns the characters, hand out views of its key
+    t.names.push_back(entry.first->getKey());
+  }
+  return entry.first->getValue();
+}
+
+llvm::StringRef Symbols::name(symbol_t sym)
+{
+  Symbols & t = table();
+  std::lock_guard<std::mutex> lock(t.mutex);
+  assert(sym < t.names.size() && "unknown symbol");
+  return t.names[sym];
+}
@@ -0,0 +1,51 @@
+#ifndef _SYMBOL_H_
+#define _SYMBOL_H_
+
+#include <mutex>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+// Interned identifier. Every distinct spelling is stored once in the symbol
+// table and referred to by a small integer, so names compare and hash as
+// integers in the AST and in the compiler tables.
+typedef unsigned symbol_t;
+
+typedef std::vector<symbol_t> symbol_vector_t;
+
+// Symbols interned up front, in this order, so that the lexer can tell
+// keywords apart by id alone
+enum ReservedSymbol : symbol_t {
+  sym_def = 0,
+  sym_if,
+  sym_then,
+  sym_else,
+  sym_for,
+  sym_in,
+  sym_extern,
+  sym_last_keyword = sym_extern,
+
+  sym_anon_expr, // name of the function wrapping top-level expressions
+  sym_num_reserved
+};
+
+class Symbols {
+ private:
+  llvm::StringMap<symbol_t> ids;     // spelling -> symbol, owns the strings
+  std::vector<llvm::StringRef> names; // symbol -> spelling
+  std::mutex mutex; // the parser interns while compile threads look up names
+
+  Symbols();
+  static Symbols & table();
+
+ public:
+  // returns the symbol for name, adding it to the table if needed
+  static symbol_t intern(llvm::StringRef name);
+  // returns the spelling of a symbol, valid for the lifetime of the process
+  static llvm::StringRef name(symbol_t sym);
+
+  static bool isKeyword(symbol_t sym) { return sym <= sym_last_keyword; }
+};
+
+#endif
@@ -0,0 +1,49 @@
+# runs a session through kcomp --server and checks that the client gets
+# what the JIT-ed code prints along with the results
+# usage: server_session.py path/to/kcomp
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+session = b"""extern putchard(c);
+def hi(x) putchard(72) + putchard(105) + putchard(10);
+hi(0);
+1 + 2;
+"""
+
+def main():
+    kcomp = sys.argv[1]
+    path = os.path.join(tempfile.mkdtemp(), "k.sock")
+    server = subprocess.Popen([kcomp, "--server", path, "--workers", "2"],
+                              stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL)
+    try:
+        for _ in range(100):
+            if os.path.exists(path):
+                break
+            time.sleep(0.1)
+        client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        client.settimeout(30)
+        client.connect(path)
+        client.sendall(session)
+        client.shutdown(socket.SHUT_WR)
+        answer = b""
+        while True:
+            data = client.recv(4096)
+            if not data:
+                break
+            answer += data
+    finally:
+        server.kill()
+        server.wait()
+    answer = answer.decode()
+    for expected in ("Hi\n", "Evaluated to 3"):
+        if expected not in answer:
+            print("missing %r in:\n%s" % (expected, answer))
+            return 1
+    return 0
+
+sys.exit(main())
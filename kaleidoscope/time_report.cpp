@@ -0,0 +1,242 @@
+#include "time_report.h"
+#include "options.h"
+
+#include "llvm/Pass.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Timer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <time.h>
+
+bool TimeReport::active = false;
+std::mutex TimeReport::mutex;
+std::vector<TimeReport::Item> TimeReport::items;
+TimeReport::Times TimeReport::totals;
+thread_local unsigned TimeReport::current_item = TimeReport::no_item;
+
+struct Frame {
+  CompilePhase phase;
+  uint64_t wall_start;
+  uint64_t cpu_start;
+};
+
+// the phases the thread is in, innermost last
+static thread_local std::vector<Frame> stack;
+
+static uint64_t wallClock()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// CPU time of the calling thread only, the compile threads run concurrently
+static uint64_t cpuClock()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static double ms(uint64_t ns) { return ns / 1e6; }
+
+static uint64_t sum(const uint64_t (&times)[num_phases])
+{
+  uint64_t total = 0;
+  for (uint64_t t : times)
+  {
+    total += t;
+  }
+  return total;
+}
+
+void TimeReport::enable(bool passes)
+{
+  active = true;
+  // read by the legacy pass managers as they run each pass, including the
+  // machine passes of the backend
+  llvm::TimePassesIsEnabled = passes;
+}
+
+void TimeReport::push(CompilePhase phase)
+{
+  uint64_t wall = wallClock();
+  uint64_t cpu = cpuClock();
+  if (!stack.empty())
+  {
+    // the enclosing phase is suspended until this one ends
+    Frame & outer = stack.back();
+    std::lock_guard<std::mutex> lock(mutex);
+    totals.wall[outer.phase] += wall - outer.wall_start;
+    totals.cpu[outer.phase] += cpu - outer.cpu_start;
+    if (current_item != no_item)
+    {
+      items[current_item].times.wall[outer.phase] += wall - outer.wall_start;
+      items[current_item].times.cpu[outer.phase] += cpu - outer.cpu_start;
+    }
+  }
+  stack.push_back(Frame{phase, wall, cpu});
+}
+
+void TimeReport::pop()
+{
+  uint64_t wall = wallClock();
+  uint64_t cpu = cpuClock();
+  const Frame & frame = stack.back();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    totals.wall[frame.phase] += wall - frame.wall_start;
+    totals.cpu[frame.phase] += cpu - frame.cpu_start;
+    if (current_item != no_item)
+    {
+      items[current_item].times.wall[frame.phase] += wall - frame.wall_start;
+      items[current_item].times.cpu[frame.phase] += cpu - frame.cpu_start;
+    }
+  }
+  stack.pop_back();
+  if (!stack.empty())
+  {
+    // resume the enclosing phase
+    stack.back().wall_start = wall;
+    stack.back().cpu_start = cpu;
+  }
+}
+
+void TimeReport::beginItem(const char * kind)
+{
+  if (!active)
+  {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  current_item = items.size();
+  items.push_back(Item{kind, std::string(), Times()});
+}
+
+void TimeReport::nameItem(symbol_t name)
+{
+  if (!active || current_item == no_item)
+  {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  items[current_item].name = Symbols::name(name).str();
+}
+
+const char * TimeReport::phaseName(CompilePhase phase)
+{
+  static const char * const names[] = {
+    "lex", "parse", "analyze", "codegen", "optimize", "backend", "link",
+    "execute"
+  };
+  return names[phase];
+}
+
+void TimeReport::print(llvm::raw_ostream & out)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (Options::time_report == time_report_json)
+  {
+    printJSON(out);
+  }
+  else
+  {
+    printText(out);
+  }
+  out.flush();
+}
+
+void TimeReport::printText(llvm::raw_ostream & out)
+{
+  uint64_t total_wall = sum(totals.wall);
+  out << "===-- Time report: " << items.size() << " top-level items --===\n"
+      << "phase            wall ms      cpu ms  wall %\n";
+  for (unsigned p = 0; p < num_phases; ++p)
+  {
+    out << llvm::format("%-12s%12.3f%12.3f%7.1f%%\n",
+			phaseName(CompilePhase(p)), ms(totals.wall[p]),
+			ms(totals.cpu[p]),
+			total_wall ? 100.0 * totals.wall[p] / total_wall : 0.0);
+  }
+  out << llvm::format("total       %12.3f%12.3f\n", ms(total_wall),
+		      ms(sum(totals.cpu)));
+
+  // the few items that took longest
+  std::vector<const Item *> slowest;
+  for (const Item & item : items)
+  {
+    slowest.push_back(&item);
+  }
+  std::sort(slowest.begin(), slowest.end(),
+	    [](const Item * a, const Item * b) {
+	      return sum(a->times.wall) > sum(b->times.wall);
+	    });
+  slowest.resize(std::min<size_t>(slowest.size(), 5));
+  if (!slowest.empty())
+  {
+    out << "slowest items:\n";
+  }
+  for (const Item * item : slowest)
+  {
+    // the phase most of the item went into
+    const uint64_t * wall = item->times.wall;
+    unsigned top = std::max_element(wall, wall + num_phases) - wall;
+    out << llvm::format("  %-8s%-18s%12.3f%12.3f  mostly %s\n", item->kind,
+			item->name.c_str(), ms(sum(item->times.wall)),
+			ms(sum(item->times.cpu)), phaseName(CompilePhase(top)));
+  }
+
+  if (llvm::TimePassesIsEnabled)
+  {
+    llvm::TimerGroup::printAll(out);
+  }
+}
+
+// "phase": {"wall_ms": ..., "cpu_ms": ...} for every phase
+static void printJSONPhases(llvm::raw_ostream & out,
+			    const TimeReport::Times & times,
+			    const char * indent)
+{
+  for (unsigned p = 0; p < num_phases; ++p)
+  {
+    out << indent << "\"" << TimeReport::phaseName(CompilePhase(p)) << "\": "
+	<< llvm::format("{\"wall_ms\": %.6f, \"cpu_ms\": %.6f}",
+			ms(times.wall[p]), ms(times.cpu[p]))
+	<< (p + 1 < num_phases ? ",\n" : "\n");
+  }
+}
+
+void TimeReport::printJSON(llvm::raw_ostream & out)
+{
+  out << "{\n"
+      << llvm::format("  \"wall_ms\": %.6f,\n  \"cpu_ms\": %.6f,\n",
+		      ms(sum(totals.wall)), ms(sum(totals.cpu)))
+      << "  \"phases\": {\n";
+  printJSONPhases(out, totals, "    ");
+  out << "  },\n"
+      << "  \"items\": [";
+  for (size_t i = 0; i < items.size(); ++i)
+  {
+    const Item & item = items[i];
+    // names are identifiers, nothing to escape
+    out << (i ? ",\n" : "\n")
+	<< "    {\n"
+	<< "      \"kind\": \"" << item.kind << "\",\n"
+	<< "      \"name\": \"" << item.name << "\",\n"
+	<< llvm::format("      \"wall_ms\": %.6f,\n      \"cpu_ms\": %.6f,\n",
+			ms(sum(item.times.wall)), ms(sum(item.times.cpu)))
+	<< "      \"phases\": {\n";
+    printJSONPhases(out, item.times, "        ");
+    out << "      }\n"
+	<< "    }";
+  }
+  out << "\n  ]";
+  if (llvm::TimePassesIsEnabled)
+  {
+    // "time.<group>.<pass>.wall": seconds, ... for every pass timer
+    out << ",\n  \"passes\": {\n";
+    llvm::TimerGroup::printAllJSONValues(out, "");
+    out << "\n  }";
+  }
+  out << "\n}\n";
+}
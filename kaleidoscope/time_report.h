@@ -0,0 +1,102 @@
+#ifndef _TIME_REPORT_H_
+#define _TIME_REPORT_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "symbol.h"
+#include "llvm/Support/raw_ostream.h"
+
+// phases of the compilation of a top-level item, in pipeline order
+enum CompilePhase : unsigned {
+  phase_lex = 0,
+  phase_parse,
+  phase_analyze,   // constant folding and type inference
+  phase_codegen,   // IR generation
+  phase_optimize,  // IR passes
+  phase_backend,   // machine code generation
+  phase_link,      // adding code to the JIT, relocation, symbol lookup
+  phase_execute,   // running top-level expressions
+  num_phases
+};
+
+// TimeReport - where the compile latency goes (--time-report). Wall and
+// thread CPU time are accumulated per phase for every top-level item (a
+// definition, an extern, a command or an expression).
+//
+// Phase timers nest: each thread keeps the stack of the phases it is in and
+// only the innermost one is charged, so the lexer called in the middle of
+// parsing, or the backend run by the JIT while linking, is not counted
+// twice and the phases of an item add up to the time spent on it. Work a
+// compile thread does for an item is charged to that item. Reading the REPL
+// from a terminal, the wall time of lexing includes waiting for input.
+class TimeReport {
+ public:
+  // nanoseconds by phase
+  struct Times {
+    uint64_t wall[num_phases] = {};
+    uint64_t cpu[num_phases] = {};
+  };
+
+  // times a phase on the current thread while in scope, a no-op when the
+  // report is off
+  class Timer {
+    bool running;
+
+   public:
+    explicit Timer(CompilePhase phase) : running(active)
+    {
+      if (running)
+      {
+	push(phase);
+      }
+    }
+    ~Timer()
+    {
+      if (running)
+      {
+	pop();
+      }
+    }
+  };
+
+  static const unsigned no_item = ~0u;
+
+ private:
+  struct Item {
+    const char * kind;
+    std::string name;
+    Times times;
+  };
+
+  static bool active;
+  static std::mutex mutex;          // items and totals, charged by all threads
+  static std::vector<Item> items;
+  static Times totals;              // also the time outside of any item
+  static thread_local unsigned current_item;
+
+  static void push(CompilePhase phase);
+  static void pop();
+  static void printText(llvm::raw_ostream & out);
+  static void printJSON(llvm::raw_ostream & out);
+
+ public:
+  // start timing, with the pass managers timing every pass if passes
+  static void enable(bool passes);
+  static bool enabled() { return active; }
+
+  // a new item, charged from now on for the phases of this thread
+  static void beginItem(const char * kind);
+  static void nameItem(symbol_t name);
+  // the item of this thread, to charge work done for it on another thread
+  static unsigned currentItem() { return current_item; }
+  static void setCurrentItem(unsigned item) { current_item = item; }
+
+  static const char * phaseName(CompilePhase phase);
+  // the summary, as text or JSON depending on the options
+  static void print(llvm::raw_ostream & out);
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "types.h"
+#include "ast.h"
+#include "kcomp.h"
+#include <cmath>
+
+const char * typeName(ValueType t)
+{
+  switch (t)
+  {
+  case type_none:
+    return "none";
+  case type_bool:
+    return "i1";
+  case type_int:
+    return "i64";
+  case type_double:
+    break;
+  }
+  return "double";
+}
+
+bool TypeInference::isIntegral(double val)
+{
+  // -0.0 stays a double, an integer zero has no sign
+  return std::trunc(val) == val && std::fabs(val) < max_exact_integer &&
+    !(val == 0.0 && std::signbit(val));
+}
+
+unsigned magnitudeBits(double val)
+{
+  int exp;
+  std::frexp(val, &exp);
+  return exp > 0 ? exp : 0;
+}
+
+ValueType TypeInference::callType(symbol_t callee, unsigned nargs,
+				  symbol_t & entry) const
+{
+  if (callee == self)
+  {
+    entry = PrototypeAST::entryName(self, self_type);
+    return self_type;
+  }
+  // the double entry point, also for unknown callees and wrong argument
+  // counts, left to codegen to report
+  entry = callee;
+  if (!KCompiler::current().whole_program)
+  {
+    return type_double;
+  }
+  auto proto = PrototypeAST::find(callee);
+  if (proto && proto->getargs().size() == nargs)
+  {
+    entry = proto->getEntry();
+    return proto->getReturnType();
+  }
+  return type_double;
+}
+
+void FunctionAST::inferTypes()
+{
+  // the body is typed again until the return type assumed for recursive
+  // calls is the one it gets, which takes at most a round per type as
+  // types only ever grow
+  ValueType ret = type_none;
+  for (;;)
+  {
+    TypeInference t(proto->getargs(), name, ret);
+    ValueType body_type = body->inferType(t);
+    if (body_type == ret && ret != type_none)
+    {
+      break;
+    }
+    // a function that only ever returns through recursion returns doubles
+    ret = body_type == type_none ? type_double : body_type;
+  }
+  proto->setReturnType(isTopLevelExpr() ? type_double : ret);
+}
+
+bool FunctionAST::isTopLevelExpr() const
+{
+  // identifiers cannot start with '_', so no definition is named like this
+  return Symbols::name(name).startswith(Symbols::name(sym_anon_expr));
+}
+
+ValueType NumberExprAST::inferType(TypeInference & t)
+{
+  type = TypeInference::isIntegral(val) ? type_int : type_double;
+  bits = type == type_int ? magnitudeBits(val) : 0;
+  return type;
+}
+
+ValueType VariableExprAST::inferType(TypeInference & t)
+{
+  unsigned var_bits;
+  type = t.variableType(name, var_bits);
+  bits = var_bits;
+  return type;
+}
+
+ValueType BinaryExprAST::inferType(TypeInference & t)
+{
+  ValueType l = promoteType(lhs->inferType(t));
+  ValueType r = promoteType(rhs->inferType(t));
+  if (op == '<')
+  {
+    type = type_bool;
+    bits = 1;
+    return type;
+  }
+  type = joinTypes(l, r);
+  if (type != type_double)
+  {
+    unsigned l_bits = lhs->getBits(), r_bits = rhs->getBits();
+    unsigned res_bits = op == '*' ? l_bits + r_bits :
+      std::max(l_bits, r_bits) + 1;
+    if (res_bits > max_int_bits)
+    {
+      // could reach 2^53, where the integers and the doubles part
+      type = type_double;
+      res_bits = 0;
+    }
+    bits = res_bits;
+  }
+  return type;
+}
+
+ValueType CallExprAST::inferType(TypeInference & t)
+{
+  // arguments are passed as doubles
+  for (ExprAST * arg : args)
+  {
+    arg->inferType(t);
+  }
+  type = t.callType(callee, args.size(), entry);
+  // an integer result is only known to be below 2^53
+  bits = type == type_bool ? 1 : type == type_double ? 0 : max_int_bits;
+  return type;
+}
+
+ValueType IfExprAST::inferType(TypeInference & t)
+{
+  Cond->inferType(t);
+  type = joinTypes(Then->inferType(t), Else->inferType(t));
+  bits = type == type_double ? 0 : std::max(Then->getBits(), Else->getBits());
+  return type;
+}
+
+bool BinaryExprAST::isUpperBound(symbol_t var, double & limit) const
+{
+  const NumberExprAST * c = rhs->asNumber();
+  if (op != '<' || !lhs->isVariable(var) || !c)
+  {
+    return false;
+  }
+  limit = c->getVal();
+  return true;
+}
+
+ValueType ForExprAST::inferType(TypeInference & t)
+{
+  // the variable counts in an integer only when it provably stays an exact
+  // double: it starts at an integer, steps up by an integer constant and
+  // the loop ends on variable < C for an integer constant C. The body then
+  // sees at most C - 1 + step and the last increment adds step again, so
+  // the variable stays within max(|start|, |C|) + 2 * step
+  ValueType start_type = start->inferType(t);
+  const NumberExprAST * inc = step ? step->asNumber() : nullptr;
+  double step_val = step ? (inc ? inc->getVal() : 0.0) : 1.0;
+  double limit;
+  double bound = max_exact_integer;
+  if (start_type != type_double && start_type != type_none &&
+      step_val >= 1 && TypeInference::isIntegral(step_val) &&
+      end->isUpperBound(var_name, limit) &&
+      TypeInference::isIntegral(limit))
+  {
+    bound = std::max(std::ldexp(1.0, start->getBits()), std::fabs(limit)) +
+      2 * step_val;
+  }
+  var_type = bound < max_exact_integer ? type_int : type_double;
+  unsigned var_bits = var_type == type_int ? magnitudeBits(bound) : 0;
+  t.pushVariable(var_name, var_type, var_bits);
+  if (step)
+  {
+    step->inferType(t);
+  }
+  end->inferType(t);
+  body->inferType(t);
+  t.popVariable();
+
+  // for expr always returns 0
+  type = type_int;
+  bits = 0;
+  return type;
+}
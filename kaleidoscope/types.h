@@ -0,0 +1,107 @@
+#ifndef _TYPES_H_
+#define _TYPES_H_
+
+#include <algorithm>
+
+#include "symbol.h"
+#include "llvm/ADT/SmallVector.h"
+
+// value types of expressions, ordered so that the join of two types is the
+// larger one: a bool widens to 0/1 and an integer to the double of the same
+// value. type_none is the type of calls not yet known to return (recursion
+// during inference).
+enum ValueType : unsigned char {
+  type_none = 0,
+  type_bool,    // i1, comparisons
+  type_int,     // i64, integral literals and arithmetic on them
+  type_double
+};
+
+// 2^53, below which every integer is an exact double
+const double max_exact_integer = 9007199254740992.0;
+const unsigned max_int_bits = 53;
+
+// the bits of the magnitude of an integer, |val| < 2^bits
+unsigned magnitudeBits(double val);
+
+inline ValueType joinTypes(ValueType a, ValueType b) { return std::max(a, b); }
+
+// operands of arithmetic and comparisons are never narrower than integers
+inline ValueType promoteType(ValueType t)
+{
+  return t == type_bool ? type_int : t;
+}
+
+// suffix of the entry points of functions returning t, "i1" or "i64"
+const char * typeName(ValueType t);
+
+// TypeInference - state of the type inference pass run on a function body
+// after simplification. Arguments are doubles, as every caller and the C
+// ABI of the definitions expect; literals that are integers below 2^53 are
+// integers, comparisons are bools, and arithmetic and conditionals take
+// the join of their operands, so that values stay integers or bools as
+// long as no double flows in.
+//
+// An integer is only kept while its magnitude provably stays below 2^53,
+// where every integer is an exact double: each integer value has a bound
+// of that many bits (see ExprAST::getBits()), a sum or difference needs a
+// bit more than its larger operand and a product the bits of both, and an
+// operation that could reach 2^53 is done in doubles instead. The result
+// of a call is only known to be below 2^53. Integer arithmetic then gives
+// the values of the double arithmetic it replaces, except that an integer
+// zero has no sign, and never overflows 64 bits.
+//
+// The return type of a definition is found by iterating to a fixpoint from
+// type_none, the type assumed for recursive calls.
+class TypeInference {
+ private:
+  struct Variable {
+    symbol_t name;
+    ValueType type;
+    unsigned bits;  // of an integer variable
+  };
+  // arguments and loop variables, innermost last
+  llvm::SmallVector<Variable, 8> scope;
+  symbol_t self;            // the function being inferred
+  ValueType self_type;      // its return type assumed in this round
+
+ public:
+  TypeInference(const symbol_vector_t & args, symbol_t self,
+		ValueType self_type)
+    : self(self), self_type(self_type)
+  {
+    for (symbol_t arg : args)
+    {
+      scope.push_back({ arg, type_double, 0 });
+    }
+  }
+
+  void pushVariable(symbol_t name, ValueType type, unsigned bits)
+  {
+    scope.push_back({ name, type, bits });
+  }
+  void popVariable() { scope.pop_back(); }
+  // the type of a variable in scope and the bits of an integer, double for
+  // unknown names (reported by codegen)
+  ValueType variableType(symbol_t name, unsigned & bits) const
+  {
+    for (auto it = scope.rbegin(), e = scope.rend(); it != e; ++it)
+    {
+      if (it->name == name)
+      {
+	bits = it->bits;
+	return it->type;
+      }
+    }
+    bits = 0;
+    return type_double;
+  }
+  // return type of the callee of a call with nargs arguments, and the name
+  // of its entry point returning that type
+  ValueType callType(symbol_t callee, unsigned nargs, symbol_t & entry) const;
+
+  // true for literals typed as integers
+  static bool isIntegral(double val);
+};
+
+#endif